@@ -0,0 +1,53 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file batch.h
+ *  @brief Batch conversion scheduler
+ *
+ *  @details
+ *  Each conversion runs in its own process. Conversions are admitted largest
+ *  first while their estimated peak memory fits the budget, and smaller ones
+ *  fill in around them; a conversion larger than the whole budget runs alone.
+ *  Every process beyond the first also needs a job token (see jobs.h), and at
+ *  most jobs::count () processes run at once.
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace batch
+{
+/** @brief Conversion to run in a child process */
+struct Job
+{
+	std::vector<std::string> args; ///< Arguments, including the program name
+	std::string dir;               ///< Working directory
+	std::string name;              ///< Name for messages
+	size_t memory;                 ///< Estimated peak memory (bytes)
+};
+
+/** @brief Run conversions within a memory budget
+ *  @param[in] queue  Conversions to run
+ *  @param[in] budget Memory budget (bytes); 0 for no limit
+ *  @returns whether every conversion succeeded
+ */
+bool run (std::vector<Job> queue, size_t budget);
+}
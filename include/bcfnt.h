@@ -27,6 +27,7 @@
 #include "magick_compat.h"
 
 #include <cstdint>
+#include <map>
 #include <memory>
 #include <vector>
 
@@ -109,11 +110,20 @@ struct CMAP
 	                                ///< or 0xFFFF if it's not valid
 };
 
+/** @brief Output compression. */
+enum Compression
+{
+	COMPRESSION_NONE, ///< No compression
+	COMPRESSION_LZ10, ///< LZSS/LZ10 compression
+	COMPRESSION_LZ11, ///< LZ11 compression
+};
+
 struct Glyph
 {
 	Magick::Image img;
 	CharWidthInfo info;
 	int ascent;
+	std::vector<std::uint8_t> alpha; ///< 8-bit alpha of img, row-major
 };
 
 class BCFNT
@@ -125,7 +135,24 @@ public:
 
 	BCFNT (const std::vector<std::uint8_t> &data);
 
-	bool serialize (const std::string &path);
+	bool serialize (const std::string &path, Compression compression = COMPRESSION_NONE);
+
+	/** @brief Verify a serialized font against this one
+	 *  @param[in] path Path of font written by serialize
+	 *  @returns whether every sheet cell, width and character mapping matches
+	 *
+	 *  @details
+	 *  Sheets are decoded straight from the 4-bit alpha data, one job per row of
+	 *  cells, and compared against each glyph's alpha. Mismatches are reported on
+	 *  stderr.
+	 */
+	bool verify (const std::string &path) const;
+
+	/** @brief Set sheet dimensions
+	 *  @param[in] width  Sheet width; 0 to choose automatically
+	 *  @param[in] height Sheet height; 0 to choose automatically
+	 */
+	void setSheetSize (std::uint16_t width, std::uint16_t height);
 
 	void addFont (std::shared_ptr<freetype::Face> face,
 	    std::vector<std::uint16_t> &list,
@@ -133,14 +160,20 @@ public:
 	void addFont (BCFNT &font, std::vector<std::uint16_t> &list, bool isBlacklist);
 
 private:
-	void readGlyphImages (std::vector<std::uint8_t>::const_iterator &bcfnt, int sheetNum);
+	void readGlyphImages (std::vector<std::uint8_t>::const_iterator &bcfnt,
+	    int sheetNum,
+	    const std::map<std::uint16_t, std::vector<std::uint16_t>> &indexCodes);
 	std::vector<Magick::Image> sheetify ();
-	std::uint16_t codepoint (std::uint16_t index) const;
+	bool hasCode (std::uint16_t code) const;
+	std::uint16_t glyphIndex (std::uint16_t code) const;
 	void refreshCMAPs ();
+	bool layoutSheets ();
 
 	std::vector<CMAP> cmaps;
 	// character code and image
 	std::map<std::uint16_t, Glyph> glyphs;
+	// character code and the character code whose glyph it shares
+	std::map<std::uint16_t, std::uint16_t> aliases;
 
 	std::uint16_t numSheets = 0;
 	std::uint16_t altIndex  = 0;
@@ -158,6 +191,10 @@ private:
 	std::uint16_t SHEET_HEIGHT = 1024;
 	std::uint32_t SHEET_SIZE   = SHEET_WIDTH * SHEET_HEIGHT / 2;
 
+	// requested sheet dimensions; 0 chooses few sheets of close to the smallest total size
+	std::uint16_t sheetWidth  = 0;
+	std::uint16_t sheetHeight = 0;
+
 	std::uint16_t glyphWidth     = 0;
 	std::uint16_t glyphHeight    = 0;
 	std::uint16_t glyphsPerRow   = 0;
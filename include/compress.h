@@ -57,6 +57,24 @@ std::vector<uint8_t> lz11Encode (const void *src, size_t len);
  */
 void lz11Decode (const void *src, void *dst, size_t len);
 
+/** @brief Parallel LZSS/LZ10 compression
+ *  @param[in] src Source buffer
+ *  @param[in] len Source length
+ *  @returns Compressed buffer
+ *  @note The input is tokenized in fixed-size chunks on multiple threads. Matches may refer back
+ *  into earlier chunks but never cross the end of a chunk, so the result is a standard LZSS/LZ10
+ *  stream that is only slightly larger than lzssEncode's.
+ */
+std::vector<uint8_t> lzssParallelEncode (const void *src, size_t len);
+
+/** @brief Parallel LZ11 compression
+ *  @param[in] src Source buffer
+ *  @param[in] len Source length
+ *  @returns Compressed buffer
+ *  @note See lzssParallelEncode
+ */
+std::vector<uint8_t> lz11ParallelEncode (const void *src, size_t len);
+
 /** @brief Run-length encoding compression
  *  @param[in] src Source buffer
  *  @param[in] len Source length
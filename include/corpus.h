@@ -0,0 +1,44 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2019
+ *     Michael Theall (mtheall)
+ *     piepie62
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file corpus.h
+ *  @brief Text corpus scanning
+ *
+ *  @details
+ *  Files starting with a UTF-16 byte order mark are decoded as UTF-16 of that
+ *  byte order; everything else is decoded as UTF-8. Control characters and
+ *  characters outside the Basic Multilingual Plane (which BCFNT cannot map)
+ *  are ignored.
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace corpus
+{
+/** @brief Collect the code points used by text files
+ *  @param[in]  paths Text files to scan
+ *  @param[out] codes Sorted list of code points used
+ *  @returns whether all files were read
+ */
+bool scan (const std::vector<std::string> &paths, std::vector<std::uint16_t> &codes);
+}
@@ -25,6 +25,7 @@
  */
 #pragma once
 
+#include "etc1_cache.h"
 #include "magick_compat.h"
 #include "rg_etc1.h"
 #include "subimage.h"
@@ -114,6 +115,16 @@ inline void encode (const SubImage &sub, uint16_t width, uint16_t height, Buffer
 	encode<float> (sub.bottom, out);
 }
 
+struct WorkUnit;
+
+/** @brief Work unit processor
+ *
+ *  @details
+ *  Encodes a work unit's tile into its result buffer and/or replaces its
+ *  pixels with the decoded preview, as selected by the encoders below.
+ */
+typedef void (*Processor) (WorkUnit &);
+
 /** @brief Work unit
  *
  *  @details
@@ -127,32 +138,36 @@ struct WorkUnit
 	PixelPacket p;                      ///< Pixel data buffer
 	size_t stride;                      ///< Pixel data stride
 	rg_etc1::etc1_quality etc1_quality; ///< ETC1 quality option
-	bool output;                        ///< Whether to output 3DS data
-	bool preview;                       ///< Whether to output preview image
-	void (*process) (WorkUnit &);       ///< Work unit processor
+	bool etc1_fast;                     ///< Use fast ETC1 encoder
+	unsigned etc1_error_target;         ///< ETC1 per-block error target (0 = off)
+	ETC1Cache *etc1_cache;              ///< ETC1 block cache (optional)
+	Processor process;                  ///< Work unit processor
 
 	/** @brief Constructor
 	 *  @param[in] sequence     Work identifier
 	 *  @param[in] p            Pixel data buffer
 	 *  @param[in] stride       Pixel data stride
 	 *  @param[in] etc1_quality ETC1 quality option
-	 *  @param[in] output       Whether to output 3DS data
-	 *  @param[in] preview      Whether to output preview image
+	 *  @param[in] etc1_fast    Use fast ETC1 encoder
+	 *  @param[in] etc1_error_target ETC1 per-block error target (0 = off)
+	 *  @param[in] etc1_cache   ETC1 block cache (optional)
 	 *  @param[in] process      Work unit processor
 	 */
 	WorkUnit (uint64_t sequence,
 	    PixelPacket p,
 	    size_t stride,
 	    rg_etc1::etc1_quality etc1_quality,
-	    bool output,
-	    bool preview,
-	    void (*process) (WorkUnit &))
+	    bool etc1_fast,
+	    unsigned etc1_error_target,
+	    ETC1Cache *etc1_cache,
+	    Processor process)
 	    : sequence (sequence),
 	      p (p),
 	      stride (stride),
 	      etc1_quality (etc1_quality),
-	      output (output),
-	      preview (preview),
+	      etc1_fast (etc1_fast),
+	      etc1_error_target (etc1_error_target),
+	      etc1_cache (etc1_cache),
 	      process (process)
 	{
 	}
@@ -181,9 +196,11 @@ struct WorkUnit
  *
  *  If the source image has no alpha channel, every pixel will be opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void rgba8888 (WorkUnit &work);
+Processor rgba8888 (bool output, bool preview);
 
 /** @brief RGB888 encoder
  *
@@ -191,9 +208,11 @@ void rgba8888 (WorkUnit &work);
  *  Outputs the tile in RGB888 (24bpp) format. Data is output in BGR order. The
  *  alpha channel is ignored; every pixel is opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void rgb888 (WorkUnit &work);
+Processor rgb888 (bool output, bool preview);
 
 /** @brief RGB565 encoder
  *
@@ -203,9 +222,11 @@ void rgb888 (WorkUnit &work);
  *  16-bit values in little-endian. The alpha channel is ignored; every pixel is
  *  opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void rgb565 (WorkUnit &work);
+Processor rgb565 (bool output, bool preview);
 
 /** @brief RGBA5551 encoder
  *
@@ -216,9 +237,11 @@ void rgb565 (WorkUnit &work);
  *
  *  If the source image has no alpha channel, every pixel will be opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void rgba5551 (WorkUnit &work);
+Processor rgba5551 (bool output, bool preview);
 
 /** @brief RGBA4444 encoder
  *
@@ -229,9 +252,11 @@ void rgba5551 (WorkUnit &work);
  *
  *  If the source image has no alpha channel, every pixel will be opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void rgba4444 (WorkUnit &work);
+Processor rgba4444 (bool output, bool preview);
 
 /** @brief LA88 encoder
  *
@@ -242,9 +267,11 @@ void rgba4444 (WorkUnit &work);
  *
  *  If the source image has no alpha channel, every pixel will be opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void la88 (WorkUnit &work);
+Processor la88 (bool output, bool preview);
 
 /** @brief HILO88 encoder
  *
@@ -253,9 +280,11 @@ void la88 (WorkUnit &work);
  *  red channel; LO corresponds to the data in the green channel. The blue and
  *  alpha channels are ignored. The data is output in LOHI order.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void hilo88 (WorkUnit &work);
+Processor hilo88 (bool output, bool preview);
 
 /** @brief L8 encoder
  *
@@ -264,9 +293,11 @@ void hilo88 (WorkUnit &work);
  *  calculated from the RGB components with gamma correction. The alpha channel
  *  is ignored; every pixel is opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void l8 (WorkUnit &work);
+Processor l8 (bool output, bool preview);
 
 /** @brief A8 encoder
  *
@@ -275,9 +306,11 @@ void l8 (WorkUnit &work);
  *
  *  If the source image has no alpha channel, every pixel will be opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void a8 (WorkUnit &work);
+Processor a8 (bool output, bool preview);
 
 /** @brief LA44 encoder
  *
@@ -288,9 +321,11 @@ void a8 (WorkUnit &work);
  *
  *  If the source image has no alpha channel, every pixel will be opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void la44 (WorkUnit &work);
+Processor la44 (bool output, bool preview);
 
 /** @brief L4 encoder
  *
@@ -300,9 +335,11 @@ void la44 (WorkUnit &work);
  *  pixels, the first resides in the lower 4 bits, and the second resides in the
  *  upper 4 bits. The alpha channel is ignored; every pixel is opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void l4 (WorkUnit &work);
+Processor l4 (bool output, bool preview);
 
 /** @brief A4 encoder
  *
@@ -313,9 +350,11 @@ void l4 (WorkUnit &work);
  *
  *  If the source image has no alpha channel, every pixel will be opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void a4 (WorkUnit &work);
+Processor a4 (bool output, bool preview);
 
 /** @brief ETC1 encoder
  *
@@ -324,9 +363,11 @@ void a4 (WorkUnit &work);
  *  each of which are encoded into a 64-bit value. Each 64-bit value is output
  *  in little-endian order. The alpha channel is ignored; every pixel is opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void etc1 (WorkUnit &work);
+Processor etc1 (bool output, bool preview);
 
 /** @brief ETC1A4 encoder
  *
@@ -338,7 +379,9 @@ void etc1 (WorkUnit &work);
  *  resides in the upper 4 bits. Each 64-bit ETC1 value is output in
  *  little-endian order. The alpha channel is ignored; every pixel is opaque.
  *
- *  @param[in] work Work unit
+ *  @param[in] output  Whether to output 3DS data
+ *  @param[in] preview Whether to output preview image
+ *  @returns work unit processor specialized for the output mode
  */
-void etc1a4 (WorkUnit &work);
+Processor etc1a4 (bool output, bool preview);
 }
@@ -0,0 +1,149 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file etc1_cache.h
+ *  @brief Persistent ETC1 block cache
+ *
+ *  @details
+ *  The cache file is a fixed-size, set-associative table of packed ETC1
+ *  blocks keyed by the RGB contents of the 4x4 input block and the encoder
+ *  variant (quality setting). The table is memory-mapped read-only and
+ *  probed without locking. New entries and hit slots are collected in memory,
+ *  sharded by key hash so encoder threads rarely share a lock, and merged into
+ *  the file under an exclusive lock when the cache is flushed. Each entry
+ *  carries a checksum so that readers racing with another process's merge
+ *  treat a torn entry as a miss. When a set is full, the least recently used
+ *  entry is evicted. On hosts without flock and mmap, only blocks from the
+ *  current run are reused.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+/** @brief Persistent ETC1 block cache */
+class ETC1Cache
+{
+public:
+	/** @brief Constructor
+	 *  @param[in] path Cache file path
+	 *  @param[in] size Cache file size (bytes) if the file has to be created
+	 */
+	ETC1Cache (const std::string &path, size_t size);
+
+	/** @brief Destructor; flushes new entries */
+	~ETC1Cache ();
+
+	ETC1Cache ()                       = delete;
+	ETC1Cache (const ETC1Cache &other) = delete;
+	ETC1Cache (ETC1Cache &&other)      = delete;
+	ETC1Cache &operator= (const ETC1Cache &other) = delete;
+	ETC1Cache &operator= (ETC1Cache &&other) = delete;
+
+	/** @brief Look up a packed block
+	 *  @param[in]  rgba    4x4 RGBA input block
+	 *  @param[in]  variant Encoder variant
+	 *  @param[out] block   Packed ETC1 block
+	 *  @returns whether the block was found
+	 */
+	bool lookup (const uint8_t *rgba, uint32_t variant, uint8_t *block);
+
+	/** @brief Insert a packed block
+	 *  @param[in] rgba    4x4 RGBA input block
+	 *  @param[in] variant Encoder variant
+	 *  @param[in] block   Packed ETC1 block
+	 */
+	void insert (const uint8_t *rgba, uint32_t variant, const uint8_t *block);
+
+	/** @brief Merge new entries into the cache file */
+	void flush ();
+
+	/** @brief Get number of lookup hits */
+	uint64_t hits () const;
+
+	/** @brief Get number of lookup misses */
+	uint64_t misses () const;
+
+private:
+	/** @brief Cache key */
+	struct Key
+	{
+		uint8_t rgb[48];  ///< RGB components of 4x4 block
+		uint32_t variant; ///< Encoder variant
+
+		bool operator== (const Key &other) const;
+	};
+
+	/** @brief Cache key hasher */
+	struct KeyHash
+	{
+		size_t operator() (const Key &key) const;
+	};
+
+	/** @brief Number of shards for entries collected during this run */
+	static constexpr unsigned SHARDS = 16;
+
+	/** @brief Entries collected during this run for one range of key hashes */
+	struct Shard
+	{
+		std::mutex mutex; ///< Mutex for this shard
+		std::unordered_map<Key, uint64_t, KeyHash> pending; ///< New entries
+		std::unordered_set<uint64_t> touched;               ///< Slots hit this run
+		uint64_t hits   = 0;                                ///< Number of lookup hits
+		uint64_t misses = 0;                                ///< Number of lookup misses
+	};
+
+	/** @brief Cache file entry */
+	struct Entry;
+
+	/** @brief Cache file header */
+	struct Header;
+
+	/** @brief Find entry in mapped cache file
+	 *  @param[in]  key   Key to find
+	 *  @param[in]  hash  Key hash
+	 *  @param[out] block Packed ETC1 block (optional)
+	 *  @returns entry slot or -1 if not found
+	 */
+	int64_t find (const Key &key, size_t hash, uint8_t *block) const;
+
+	/** @brief Get shard for a key hash
+	 *  @param[in] hash Key hash
+	 *  @returns shard
+	 */
+	Shard &shard (size_t hash)
+	{
+		// the bucket is hash % buckets; take the shard from the high half
+		return m_shards[(hash >> (sizeof (hash) * 4)) % SHARDS];
+	}
+
+	/** @brief Unmap cache file */
+	void unmap ();
+
+	std::string m_path;     ///< Cache file path
+	int m_fd;               ///< Cache file descriptor
+	uint8_t *m_map;         ///< Mapped cache file
+	size_t m_mapSize;       ///< Mapped cache file size
+	uint64_t m_buckets;     ///< Number of buckets in cache file
+	Shard m_shards[SHARDS]; ///< Entries collected during this run
+};
@@ -0,0 +1,42 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file etc1_fast.h
+ *  @brief Fast ETC1 block packer
+ *
+ *  @details
+ *  Each subblock uses its average color as the base color. The intensity
+ *  table and selectors are then chosen from the projection of each pixel onto
+ *  the luma axis relative to that base, which avoids rg_etc1's search over
+ *  base colors. Both flip orientations are tried and the one with the lower
+ *  error is kept.
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace etc1_fast
+{
+/** @brief Pack ETC1 block
+ *  @param[out] block Packed ETC1 block (big-endian, same layout as rg_etc1)
+ *  @param[in]  rgba  4x4 RGBA input block
+ *  @returns squared error of result
+ */
+unsigned pack_etc1_block (uint8_t *block, const uint8_t *rgba);
+}
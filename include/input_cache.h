@@ -0,0 +1,66 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file input_cache.h
+ *  @brief Decoded input cache
+ *
+ *  @details
+ *  When retention is enabled, decoded inputs are kept in memory and reused
+ *  until the file's modification time or size changes. This lets a warm
+ *  process (--watch) skip decoding inputs that did not change.
+ *
+ *  With a cache directory, decoded RGBA pixels are also stored on disk, one
+ *  memory-mappable file per input, keyed by path, size and modification time.
+ *  If only the modification time changed, the entry is still used when the
+ *  content hash matches. Loads through the on-disk cache always give 8-bit
+ *  RGBA images, whether the entry was read or just written.
+ */
+#pragma once
+
+#include "magick_compat.h"
+
+#include <string>
+#include <vector>
+
+namespace input_cache
+{
+/** @brief Set whether decoded inputs are kept between loads
+ *  @param[in] enable Whether to keep decoded inputs
+ */
+void setRetain (bool enable);
+
+/** @brief Set on-disk cache directory; created if it does not exist
+ *  @param[in] dir Cache directory; empty for no on-disk cache
+ *  @returns whether successful
+ */
+bool setDirectory (const std::string &dir);
+
+/** @brief Load image, as Magick::Image (path)
+ *  @param[in] path Input path
+ *  @returns decoded image
+ */
+Magick::Image image (const std::string &path);
+
+/** @brief Load every frame of an animation (GIF, APNG, MNG, WebP)
+ *  @param[in] path Input path
+ *  @returns decoded frames, coalesced into full images if there are several; other formats
+ *           give their first image only, as image ()
+ */
+std::vector<Magick::Image> frames (const std::string &path);
+}
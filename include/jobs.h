@@ -0,0 +1,163 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file jobs.h
+ *  @brief Thread budget
+ *
+ *  @details
+ *  Our own worker threads and ImageMagick's OpenMP threads share a single
+ *  budget. ImageMagick is limited to the same number of threads, and to a
+ *  single thread while our workers are running.
+ *
+ *  When run from GNU make with a jobserver (--jobserver-auth in MAKEFLAGS),
+ *  each thread beyond the first also needs a job token from make, so that a
+ *  parallel build does not start a full set of threads in every recipe. The
+ *  process's first thread runs on the token make implicitly gave it.
+ */
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace jobs
+{
+/** @brief Get thread budget
+ *  @returns number of threads to use
+ */
+unsigned count ();
+
+/** @brief Set thread budget; also sets ImageMagick's thread limit
+ *  @param[in] count Number of threads; 0 for the number of hardware threads
+ */
+void setCount (unsigned count);
+
+/** @brief Set ImageMagick memory limit; larger pixel caches go to disk
+ *  @param[in] mib Memory limit in MiB
+ */
+void setMemoryLimit (size_t mib);
+
+/** @brief Share the thread budget with child processes through a jobserver
+ *  @returns whether child processes can take job tokens
+ *
+ *  @note Under GNU make, its jobserver is passed on instead; otherwise MAKEFLAGS
+ *  advertises a new jobserver holding count () - 1 tokens
+ */
+bool serveTokens ();
+
+/** @brief Parse thread count argument
+ *  @param[in]  str   Argument
+ *  @param[out] count Number of threads
+ *  @returns whether successful
+ */
+bool parseCount (const char *str, unsigned &count);
+
+/** @brief Parse memory limit argument
+ *  @param[in]  str Argument
+ *  @param[out] mib Memory limit in MiB
+ *  @returns whether successful
+ */
+bool parseMemoryLimit (const char *str, size_t &mib);
+
+/** @brief Job token for one extra thread */
+class Token
+{
+public:
+	/** @brief Constructor; does not hold a token */
+	Token ();
+
+	/** @brief Destructor; returns the token */
+	~Token ();
+
+	/** @brief Move constructor
+	 *  @param[in] other Token to move from
+	 */
+	Token (Token &&other);
+
+	/** @brief Move assignment
+	 *  @param[in] other Token to move from
+	 *  @returns reference to this
+	 */
+	Token &operator= (Token &&other);
+
+	Token (const Token &other) = delete;
+	Token &operator= (const Token &other) = delete;
+
+	/** @brief Try to take a token without blocking; always succeeds without a jobserver
+	 *  @returns whether a token is held
+	 */
+	bool acquire ();
+
+	/** @brief Return the token */
+	void release ();
+
+	/** @brief Get whether a token is held
+	 *  @returns whether a token is held
+	 */
+	bool held () const
+	{
+		return m_held;
+	}
+
+private:
+	char m_value; ///< Token value read from the jobserver
+	bool m_held;  ///< Whether a token is held
+};
+
+/** @brief Tokens for a fixed set of threads, including the calling thread */
+class Reservation
+{
+public:
+	/** @brief Constructor
+	 *  @param[in] want Number of threads wanted; capped by count()
+	 */
+	explicit Reservation (size_t want);
+
+	/** @brief Get number of threads to run
+	 *  @returns number of threads, including the calling thread
+	 */
+	size_t threads () const
+	{
+		return tokens.size () + 1;
+	}
+
+	Reservation (const Reservation &other) = delete;
+	Reservation (Reservation &&other)      = delete;
+	Reservation &operator= (const Reservation &other) = delete;
+	Reservation &operator= (Reservation &&other) = delete;
+
+private:
+	std::vector<Token> tokens; ///< Tokens for extra threads
+};
+
+/** @brief Limit ImageMagick to one thread while our workers run */
+class SerialMagick
+{
+public:
+	/** @brief Constructor */
+	SerialMagick ();
+
+	/** @brief Destructor */
+	~SerialMagick ();
+
+	SerialMagick (const SerialMagick &other) = delete;
+	SerialMagick (SerialMagick &&other)      = delete;
+	SerialMagick &operator= (const SerialMagick &other) = delete;
+	SerialMagick &operator= (SerialMagick &&other) = delete;
+};
+}
@@ -0,0 +1,61 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file phf.h
+ *  @brief Minimal perfect hashing
+ *
+ *  @details
+ *  Keys are first hashed into buckets with seed 0. Buckets are placed largest
+ *  first: each gets the smallest seed (its displacement) that sends all of
+ *  its keys to free slots. Single-key buckets take any remaining free slot
+ *  directly, stored as -(slot + 1). A lookup therefore costs at most two
+ *  hashes and one comparison.
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace phf
+{
+/** @brief Seeded FNV-1a hash; generated lookup code must match this exactly
+ *  @param[in] seed Seed
+ *  @param[in] key  Key to hash
+ *  @returns hash
+ */
+uint32_t hash (uint32_t seed, const std::string &key);
+
+/** @brief Build minimal perfect hash
+ *  @param[in]  keys     Distinct keys
+ *  @param[out] displace Displacement for each bucket
+ *  @param[out] slots    Key index for each slot
+ *  @returns whether successful
+ */
+bool build (const std::vector<std::string> &keys,
+    std::vector<int32_t> &displace,
+    std::vector<size_t> &slots);
+
+/** @brief Find slot for a key
+ *  @param[in] displace Displacement for each bucket
+ *  @param[in] key      Key to find
+ *  @returns slot; the caller must compare the key stored there
+ */
+size_t lookup (const std::vector<int32_t> &displace, const std::string &key);
+}
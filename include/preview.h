@@ -0,0 +1,47 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file preview.h
+ *  @brief Asynchronous preview writer
+ *
+ *  @details
+ *  Previews are written on a background thread while the rest of the
+ *  conversion continues. PNG previews use a built-in writer at the fastest
+ *  zlib level and QOI previews use a built-in QOI writer; other formats go
+ *  through ImageMagick.
+ */
+#pragma once
+
+#include "magick_compat.h"
+
+#include <string>
+
+namespace preview
+{
+/** @brief Start writing a preview
+ *  @param[in] img  Preview image
+ *  @param[in] path Output path; .qoi selects QOI, .png or no known extension selects PNG
+ */
+void write (const Magick::Image &img, const std::string &path);
+
+/** @brief Wait for outstanding previews to be written
+ *  @returns whether every preview was written
+ */
+bool wait ();
+}
@@ -25,6 +25,9 @@ namespace rg_etc1
       etc1_quality m_quality;
       bool m_dithering;
 
+      // Stop searching as soon as the block's squared error is at or below this value (0 = exhaustive search for the chosen quality).
+      unsigned int m_error_target;
+
       inline etc1_pack_params()
       {
          clear();
@@ -34,6 +37,7 @@ namespace rg_etc1
       {
          m_quality = cHighQuality;
          m_dithering = false;
+         m_error_target = 0;
       }
    };
 
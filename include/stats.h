@@ -0,0 +1,113 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file stats.h
+ *  @brief Run statistics
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+namespace stats
+{
+/** @brief Statistics clock */
+typedef std::chrono::steady_clock Clock;
+
+/** @brief Whether statistics are being collected */
+extern bool enabled;
+
+/** @brief Add time to a named timer
+ *  @param[in] name     Timer name
+ *  @param[in] duration Time to add
+ */
+void addTime (const char *name, Clock::duration duration);
+
+/** @brief Add to a named counter
+ *  @param[in] name  Counter name
+ *  @param[in] count Amount to add
+ */
+void addCount (const char *name, uint64_t count);
+
+/** @brief Get a named counter
+ *  @param[in] name Counter name
+ *  @returns counter value
+ */
+uint64_t getCount (const char *name);
+
+/** @brief Clear all timers, counters and allocation counts */
+void reset ();
+
+/** @brief Print timers and counters in the order they were first used
+ *  @param[in] fp File handle
+ */
+void print (FILE *fp);
+
+/** @brief Enter a named stage; allocations are counted against the innermost stage
+ *  @param[in] name Stage name
+ *  @returns previous stage
+ */
+unsigned enterStage (const char *name);
+
+/** @brief Leave a stage
+ *  @param[in] stage Stage returned by enterStage
+ */
+void leaveStage (unsigned stage);
+
+/** @brief Print allocation counts and bytes per stage and per thread
+ *  @param[in] fp File handle
+ *
+ *  @note Allocations are only counted when configured with --enable-alloc-stats
+ */
+void printAllocations (FILE *fp);
+
+/** @brief Add the lifetime of this object to a named timer */
+class ScopedTimer
+{
+public:
+	/** @brief Constructor
+	 *  @param[in] name Timer name
+	 */
+	explicit ScopedTimer (const char *name)
+	    : name (name), start (Clock::now ()), previousStage (enterStage (name))
+	{
+	}
+
+	/** @brief Destructor */
+	~ScopedTimer ()
+	{
+		leaveStage (previousStage);
+
+		if (enabled)
+			addTime (name, Clock::now () - start);
+	}
+
+	ScopedTimer ()                         = delete;
+	ScopedTimer (const ScopedTimer &other) = delete;
+	ScopedTimer (ScopedTimer &&other)      = delete;
+	ScopedTimer &operator= (const ScopedTimer &other) = delete;
+	ScopedTimer &operator= (ScopedTimer &&other) = delete;
+
+private:
+	const char *name;        ///< Timer name
+	Clock::time_point start; ///< Start time
+	unsigned previousStage;  ///< Enclosing allocation stage
+};
+}
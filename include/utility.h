@@ -24,6 +24,13 @@
 
 #include "magick_compat.h"
 
+/** @brief Trim transparent or solid borders
+ *  @param[in] img Image to trim
+ *  @returns trimmed image; the original if it is entirely one color
+ */
 Magick::Image applyTrim (Magick::Image &img);
 
+/** @brief Extrude edge pixels outward by one pixel on each side
+ *  @param[in,out] img Image to extrude
+ */
 void applyEdge (Magick::Image &img);
@@ -22,14 +22,22 @@
  */
 
 #include "atlas.h"
+#include "input_cache.h"
+#include "jobs.h"
 #include "subimage.h"
 #include "utility.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <map>
 #include <set>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace
@@ -122,31 +130,7 @@ struct Packer
 
 	Packer (const std::vector<Magick::Image> &images, size_t width, size_t height, unsigned border);
 
-	Magick::Image composite () const
-	{
-		Magick::Image img (Magick::Geometry (width, height), transparent ());
-
-		for (const auto &block : placed)
-		{
-			if (!block.rotated)
-				img.composite (
-				    block.img, Magick::Geometry (0, 0, block.x, block.y), Magick::OverCompositeOp);
-			else
-			{
-				Magick::Image copy = block.img;
-				copy.rotate (-90);
-				img.composite (
-				    copy, Magick::Geometry (0, 0, block.x, block.y), Magick::OverCompositeOp);
-			}
-		}
-
-		return img;
-	}
-
-	void draw () const
-	{
-		Magick::Image img = composite ();
-	}
+	Magick::Image composite () const;
 
 	void pack (size_t &x, size_t &y, size_t w, size_t h);
 	size_t calc_score (size_t x, size_t y, size_t w, size_t h);
@@ -258,13 +242,77 @@ bool Packer::solve ()
 		add_free (block.x, block.y + block.h, false);
 
 		fixup ();
-
-		draw ();
 	}
 
 	return true;
 }
 
+Magick::Image Packer::composite () const
+{
+	// placed blocks never overlap, so they are blitted into one RGBA buffer in parallel; 16 bits
+	// per component keep Q16 inputs at full precision
+	std::vector<uint16_t> atlas (width * height * 4, 0);
+	std::vector<const Block *> blocks;
+	for (const auto &block : placed)
+		blocks.emplace_back (&block);
+
+	std::atomic<size_t> next (0);
+	auto worker = [&]() {
+		std::vector<uint16_t> pixels;
+		size_t i;
+		while ((i = next++) < blocks.size ())
+		{
+			const Block &block = *blocks[i];
+			Magick::Image img  = block.img;
+
+			const size_t w = img.columns ();
+			const size_t h = img.rows ();
+			pixels.resize (w * h * 4);
+			img.write (0, 0, w, h, "RGBA", Magick::ShortPixel, pixels.data ());
+
+			// fully transparent pixels match the transparent canvas
+			for (size_t p = 0; p < pixels.size (); p += 4)
+			{
+				if (pixels[p + 3] == 0)
+					std::memset (&pixels[p], 0, 4 * sizeof (uint16_t));
+			}
+
+			if (!block.rotated)
+			{
+				for (size_t y = 0; y < h; ++y)
+				{
+					std::memcpy (&atlas[((block.y + y) * width + block.x) * 4],
+					    &pixels[y * w * 4],
+					    w * 4 * sizeof (uint16_t));
+				}
+				continue;
+			}
+
+			// rotate 90 degrees counter-clockwise while copying
+			for (size_t y = 0; y < w; ++y)
+			{
+				uint16_t *out = &atlas[((block.y + y) * width + block.x) * 4];
+				for (size_t x = 0; x < h; ++x)
+				{
+					std::memcpy (
+					    &out[x * 4], &pixels[(x * w + w - 1 - y) * 4], 4 * sizeof (uint16_t));
+				}
+			}
+		}
+	};
+
+	jobs::Reservation reservation (blocks.size ());
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < reservation.threads (); ++i)
+		workers.emplace_back (worker);
+
+	worker ();
+	for (auto &thread : workers)
+		thread.join ();
+
+	return Magick::Image (width, height, "RGBA", Magick::ShortPixel, atlas.data ());
+}
+
 void Packer::pack (size_t &x, size_t &y, size_t w, size_t h)
 {
 	bool intersects_left = (x == 0) || intersects_placed (x - 1, y);
@@ -341,6 +389,71 @@ size_t Packer::calc_score (size_t x, size_t y, size_t w, size_t h)
 	return score;
 }
 
+/** @brief Sub-image that is identical to another */
+struct Alias
+{
+	size_t index;     ///< Sub-image index
+	size_t owner;     ///< Index of the identical sub-image
+	std::string name; ///< Sub-image name
+};
+
+/** @brief Name a frame of a multi-frame input
+ *  @param[in] path  Input path
+ *  @param[in] frame Frame index
+ *  @returns path with the frame index appended to the file stem
+ */
+std::string frameName (const std::string &path, size_t frame)
+{
+	const size_t slash = path.rfind ('/');
+	size_t dot         = path.rfind ('.');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		dot = path.size ();
+
+	return path.substr (0, dot) + "_" + std::to_string (frame) + path.substr (dot);
+}
+
+/** @brief Get the name an input is known by in headers and lookups
+ *  @param[in] path Input path
+ *  @returns file name without directory or extension
+ */
+std::string nameStem (const std::string &path)
+{
+	const size_t slash = path.rfind ('/');
+	std::string name   = slash == std::string::npos ? path : path.substr (slash + 1);
+
+	const size_t dot = name.rfind ('.');
+	if (dot != std::string::npos)
+		name.resize (dot);
+
+	return name;
+}
+
+/** @brief Read an input; animations are coalesced into full frames
+ *  @param[in]  path   Input path
+ *  @param[out] images Input frames
+ *  @param[out] names  Generated frame names
+ */
+void readFrames (const std::string &path,
+    std::vector<Magick::Image> &images,
+    std::vector<std::string> &names)
+{
+	std::vector<Magick::Image> frames = input_cache::frames (path);
+
+	if (frames.size () == 1)
+	{
+		images.emplace_back (std::move (frames.front ()));
+		return;
+	}
+
+	for (size_t i = 0; i < frames.size (); ++i)
+	{
+		names.emplace_back (frameName (path, i));
+		frames[i].fileName (names.back ());
+		frames[i].page (Magick::Geometry (frames[i].columns (), frames[i].rows ()));
+		images.emplace_back (std::move (frames[i]));
+	}
+}
+
 struct AreaSizeComparator
 {
 	bool compare (size_t w1, size_t h1, size_t w2, size_t h2) const
@@ -374,19 +487,75 @@ Atlas Atlas::build (const std::vector<std::string> &paths,
     unsigned border,
     unsigned edge)
 {
-	std::vector<Magick::Image> images;
-
+	// decode each input once; animations contribute one sub-image per frame
+	std::vector<Magick::Image> inputs;
+	std::vector<std::string> frameNames;
 	for (const auto &path : paths)
+		readFrames (path, inputs, frameNames);
+
+	// a generated frame name must not be the name of another input or frame
+	std::map<std::string, size_t> stems;
+	for (const auto &img : inputs)
+		++stems[nameStem (img.fileName ())];
+
+	for (const auto &name : frameNames)
+	{
+		if (stems[nameStem (name)] > 1)
+		{
+			throw std::runtime_error ("Animation frame name '" + nameStem (name) +
+			                          "' is also used by another input");
+		}
+	}
+
+	// trim and edge frames in parallel
+	jobs::SerialMagick serial_magick;
+	std::atomic<size_t> next (0);
+	auto worker = [&]() {
+		size_t i;
+		while ((i = next++) < inputs.size ())
+		{
+			Magick::Image &img = inputs[i];
+
+			if (trim)
+				img = applyTrim (img);
+
+			if (edge)
+				applyEdge (img);
+
+			// compute the pixel signature here rather than serially below
+			img.signature ();
+		}
+	};
+
+	jobs::Reservation reservation (inputs.size ());
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < reservation.threads (); ++i)
+		workers.emplace_back (worker);
+
+	worker ();
+	for (auto &thread : workers)
+		thread.join ();
+
+	// only the first of several identical images is packed; the rest share its placement
+	std::vector<Magick::Image> images;
+	std::vector<Alias> aliases;
+	std::unordered_map<std::string, size_t> unique;
+	for (size_t i = 0; i < inputs.size (); ++i)
 	{
-		Magick::Image img (path);
+		Magick::Image &img = inputs[i];
 
-		if (trim)
-			img = applyTrim (img);
+		const std::string key = img.signature () + ":" + std::to_string (img.columns ()) + "x" +
+		                        std::to_string (img.rows ());
 
-		if (edge)
-			applyEdge (img);
+		auto it = unique.find (key);
+		if (it != std::end (unique))
+		{
+			aliases.emplace_back (Alias{i, it->second, img.fileName ()});
+			continue;
+		}
 
-		img.attribute ("index", std::to_string (images.size ()));
+		unique.emplace (key, i);
+		img.attribute ("index", std::to_string (i));
 		images.emplace_back (std::move (img));
 	}
 
@@ -422,8 +591,24 @@ Atlas Atlas::build (const std::vector<std::string> &paths,
 			Atlas atlas;
 
 			atlas.img = packer.composite ();
+			std::map<size_t, size_t> placed;
 			for (auto &block : packer.placed)
+			{
+				placed.emplace (block.index, atlas.subs.size ());
 				atlas.subs.emplace_back (block.subImage (atlas.img, border, edge));
+			}
+
+			for (const auto &alias : aliases)
+			{
+				const SubImage sub = atlas.subs[placed.at (alias.owner)];
+				atlas.subs.emplace_back (alias.index,
+				    alias.name,
+				    sub.left,
+				    sub.top,
+				    sub.right,
+				    sub.bottom,
+				    sub.rotated);
+			}
 
 			std::sort (std::begin (atlas.subs), std::end (atlas.subs));
 			return atlas;
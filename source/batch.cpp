@@ -0,0 +1,228 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file batch.cpp
+ *  @brief Batch conversion scheduler
+ */
+
+#include "batch.h"
+#include "jobs.h"
+#include "stats.h"
+
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_SYS_WAIT_H) && defined(HAVE_UNISTD_H) &&          \
+    defined(HAVE_FORK) && defined(HAVE_WAIT4)
+/** @brief Whether conversions can run in child processes */
+#define BATCH_PROCESSES 1
+#endif
+
+#ifdef BATCH_PROCESSES
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <thread>
+
+/** @brief Time between attempts to take a job token (ms) */
+#define BATCH_POLL_MS 20
+
+#ifdef BATCH_PROCESSES
+namespace
+{
+/** @brief Running conversion */
+struct Running
+{
+	batch::Job job;                 ///< Conversion
+	stats::Clock::time_point start; ///< Start time
+	jobs::Token token;              ///< Token for this process; none for the first
+};
+
+/** @brief Get the program to run conversions with
+ *  @param[in] prog Program name, as argv[0]
+ *  @returns absolute path if prog names a file; otherwise prog, to be looked up in PATH
+ */
+std::string program (const std::string &prog)
+{
+	if (prog.find ('/') == std::string::npos)
+		return prog;
+
+	// children change directory before exec
+	char *path = ::realpath (prog.c_str (), nullptr);
+	if (!path)
+		return prog;
+
+	const std::string result = path;
+	std::free (path);
+	return result;
+}
+
+/** @brief Start conversion in a child process
+ *  @param[in] job Conversion to start
+ *  @returns child process id; -1 on failure
+ */
+pid_t spawn (const batch::Job &job)
+{
+	const std::string file = program (job.args.front ());
+
+	std::vector<char *> args;
+	for (const auto &arg : job.args)
+	{
+		// execv only take non-const :(
+		args.emplace_back (const_cast<char *> (arg.c_str ()));
+	}
+	args.emplace_back (nullptr);
+
+	const pid_t pid = ::fork ();
+	if (pid < 0)
+	{
+		std::fprintf (stderr, "fork: %s\n", std::strerror (errno));
+		return -1;
+	}
+
+	if (pid == 0)
+	{
+		if (!job.dir.empty () && ::chdir (job.dir.c_str ()) != 0)
+		{
+			std::fprintf (stderr, "chdir '%s': %s\n", job.dir.c_str (), std::strerror (errno));
+			::_exit (EXIT_FAILURE);
+		}
+
+		::execvp (file.c_str (), args.data ());
+		std::fprintf (stderr, "execvp '%s': %s\n", file.c_str (), std::strerror (errno));
+		::_exit (EXIT_FAILURE);
+	}
+
+	return pid;
+}
+}
+#endif
+
+bool batch::run (std::vector<Job> queue, size_t budget)
+{
+#ifndef BATCH_PROCESSES
+	std::fprintf (stderr, "--batch is not supported on this platform\n");
+	return false;
+#else
+	std::stable_sort (std::begin (queue), std::end (queue), [](const Job &lhs, const Job &rhs) {
+		return lhs.memory > rhs.memory;
+	});
+
+	std::map<pid_t, Running> running;
+	size_t used = 0;
+	bool ok     = true;
+
+	while (!queue.empty () || !running.empty ())
+	{
+		// admit the largest conversions that fit; smaller ones fill in around them
+		bool needToken = false;
+		for (auto it = std::begin (queue); it != std::end (queue);)
+		{
+			if (running.size () >= jobs::count ())
+				break;
+
+			if (!running.empty () && budget && used + it->memory > budget)
+			{
+				++it;
+				continue;
+			}
+
+			// the first process runs on our own token
+			jobs::Token token;
+			if (!running.empty () && !token.acquire ())
+			{
+				needToken = true;
+				break;
+			}
+
+			const pid_t pid = spawn (*it);
+			if (pid < 0)
+			{
+				std::fprintf (stderr, "Failed to convert %s\n", it->name.c_str ());
+				ok = false;
+			}
+			else
+			{
+				used += it->memory;
+				running.emplace (
+				    pid, Running{std::move (*it), stats::Clock::now (), std::move (token)});
+			}
+
+			it = queue.erase (it);
+		}
+
+		if (running.empty ())
+			continue;
+
+		// wait for a conversion to finish; poll while a token might free up elsewhere
+		int status;
+		struct rusage usage;
+		const pid_t pid = ::wait4 (-1, &status, needToken ? WNOHANG : 0, &usage);
+		if (pid == 0)
+		{
+			std::this_thread::sleep_for (std::chrono::milliseconds (BATCH_POLL_MS));
+			continue;
+		}
+
+		if (pid < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			std::fprintf (stderr, "wait4: %s\n", std::strerror (errno));
+			return false;
+		}
+
+		auto it = running.find (pid);
+		if (it == std::end (running))
+			continue;
+
+		const Job &job = it->second.job;
+		if (WIFEXITED (status) && WEXITSTATUS (status) == EXIT_SUCCESS)
+		{
+			const double ms =
+			    std::chrono::duration_cast<std::chrono::duration<double, std::milli>> (
+			        stats::Clock::now () - it->second.start)
+			        .count ();
+
+			// ru_maxrss is in KiB
+			std::printf ("Converted %s (%.0f ms, %ld MiB peak, %zu MiB estimated)\n",
+			    job.name.c_str (),
+			    ms,
+			    usage.ru_maxrss >> 10,
+			    job.memory >> 20);
+		}
+		else
+		{
+			std::fprintf (stderr, "Failed to convert %s\n", job.name.c_str ());
+			ok = false;
+		}
+
+		used -= job.memory;
+		running.erase (it);
+	}
+
+	return ok;
+#endif
+}
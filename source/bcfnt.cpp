@@ -25,9 +25,11 @@
 #include "magick_compat.h"
 
 #include "bcfnt.h"
+#include "compress.h"
 #include "freetype.h"
 #include "future.h"
 #include "quantum.h"
+#include "stats.h"
 #include "swizzle.h"
 #include "threadPool.h"
 
@@ -39,6 +41,7 @@
 #include <iterator>
 #include <limits>
 #include <map>
+#include <unordered_map>
 
 namespace
 {
@@ -78,7 +81,8 @@ bcfnt::Glyph renderGlyph (FT_Face face, FT_UInt index)
 	    bcfnt::CharWidthInfo{static_cast<std::int8_t> (face->glyph->metrics.horiBearingX >> 6),
 	        static_cast<std::uint8_t> (face->glyph->metrics.width >> 6),
 	        static_cast<std::uint8_t> (face->glyph->metrics.horiAdvance >> 6)},
-	    	face->glyph->bitmap_top};
+	    face->glyph->bitmap_top,
+	    {}};
 
 	const unsigned width  = face->glyph->bitmap.width;
 	const unsigned height = face->glyph->bitmap.rows;
@@ -89,13 +93,15 @@ bcfnt::Glyph renderGlyph (FT_Face face, FT_UInt index)
 	glyph.img = Magick::Image (Magick::Geometry (width, height), transparent ());
 	glyph.img.magick ("A");
 
+	glyph.alpha.reserve (width * height);
+
 	Magick::Color c;
 
 	Pixels cache (glyph.img);
 	PixelPacket out = cache.get (0, 0, width, height);
-	auto in         = face->glyph->bitmap.buffer;
 	for (unsigned y = 0; y < height; ++y)
 	{
+		auto in = face->glyph->bitmap.buffer + y * face->glyph->bitmap.pitch;
 		for (unsigned x = 0; x < width; ++x)
 		{
 			const std::uint8_t v = *in++;
@@ -103,6 +109,7 @@ bcfnt::Glyph renderGlyph (FT_Face face, FT_UInt index)
 			quantumAlpha (c, bits_to_quantum<8> (v));
 
 			*out++ = c;
+			glyph.alpha.emplace_back (v);
 		}
 	}
 
@@ -144,6 +151,66 @@ Magick::Image unpackSheet (std::vector<std::uint8_t>::const_iterator &it,
 	return ret;
 }
 
+/** @brief Get a pixel from a packed 4-bit alpha sheet
+ *  @param[in] sheet Sheet data
+ *  @param[in] width Sheet width
+ *  @param[in] x     X coordinate
+ *  @param[in] y     Y coordinate
+ *  @returns 4-bit alpha
+ */
+inline std::uint8_t sheetAlpha (const std::uint8_t *sheet,
+    unsigned width,
+    unsigned x,
+    unsigned y)
+{
+	// 8x8 tiles in row-major order; pixels within a tile in Morton order
+	const unsigned tile = (y / 8) * (width / 8) + x / 8;
+	const unsigned pixel = ((x & 1) << 0) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) |
+	                       ((x & 4) << 2) | ((y & 4) << 3);
+
+	const std::uint8_t data = sheet[tile * 8 * 8 / 2 + pixel / 2];
+	return (pixel & 1) ? (data >> 4) : (data & 0xF);
+}
+
+/** @brief Read a whole file
+ *  @param[in]  path Path to read
+ *  @param[out] data File contents
+ *  @returns whether successful
+ */
+bool readFile (const std::string &path, std::vector<std::uint8_t> &data)
+{
+	FILE *fp = std::fopen (path.c_str (), "rb");
+	if (!fp)
+	{
+		std::fprintf (stderr, "fopen '%s': %s\n", path.c_str (), std::strerror (errno));
+		return false;
+	}
+
+	data.clear ();
+
+	std::uint8_t buffer[65536];
+	std::size_t rc;
+	while ((rc = std::fread (buffer, 1, sizeof (buffer), fp)) > 0)
+		data.insert (std::end (data), buffer, buffer + rc);
+
+	if (std::ferror (fp))
+	{
+		std::fprintf (stderr, "fread: %s\n", std::strerror (errno));
+		std::fclose (fp);
+		return false;
+	}
+
+	std::fclose (fp);
+	return true;
+}
+
+/** @brief Sheet cell that differs from its glyph */
+struct CellMismatch
+{
+	std::uint32_t index;  ///< Glyph index
+	std::uint32_t pixels; ///< Number of differing pixels
+};
+
 void coalesceCMAP (std::vector<bcfnt::CMAP> &cmaps)
 {
 	static constexpr auto MIN_CHARS          = 7;
@@ -185,6 +252,133 @@ void coalesceCMAP (std::vector<bcfnt::CMAP> &cmaps)
 	    std::move (scanMap)});
 }
 
+/** @brief Collect the character codes mapped to each glyph index
+ *  @param[in] cmaps Character maps
+ *  @returns glyph index and its character codes in ascending order
+ */
+std::map<std::uint16_t, std::vector<std::uint16_t>> codesByIndex (
+    const std::vector<bcfnt::CMAP> &cmaps)
+{
+	std::map<std::uint16_t, std::vector<std::uint16_t>> indexCodes;
+
+	for (const auto &cmap : cmaps)
+	{
+		switch (cmap.mappingMethod)
+		{
+		case bcfnt::CMAPData::CMAP_TYPE_DIRECT:
+		{
+			const auto &direct = dynamic_cast<const bcfnt::CMAPDirect &> (*cmap.data);
+			for (unsigned code = cmap.codeBegin; code <= cmap.codeEnd; ++code)
+				indexCodes[direct.offset + code - cmap.codeBegin].emplace_back (code);
+			break;
+		}
+
+		case bcfnt::CMAPData::CMAP_TYPE_TABLE:
+		{
+			const auto &table = dynamic_cast<const bcfnt::CMAPTable &> (*cmap.data);
+			for (std::size_t i = 0; i < table.table.size (); ++i)
+			{
+				if (table.table[i] != 0xFFFF)
+					indexCodes[table.table[i]].emplace_back (cmap.codeBegin + i);
+			}
+			break;
+		}
+
+		case bcfnt::CMAPData::CMAP_TYPE_SCAN:
+		{
+			const auto &scan = dynamic_cast<const bcfnt::CMAPScan &> (*cmap.data);
+			for (const auto &pair : scan.entries)
+				indexCodes[pair.second].emplace_back (pair.first);
+			break;
+		}
+
+		default:
+			std::abort ();
+		}
+	}
+
+	for (auto &pair : indexCodes)
+		std::sort (std::begin (pair.second), std::end (pair.second));
+
+	return indexCodes;
+}
+
+/** @brief Rendered glyph */
+struct RenderedGlyph
+{
+	std::vector<std::uint16_t> codes; ///< Character codes using this face glyph
+	bcfnt::Glyph glyph;               ///< Glyph
+	std::uint64_t hash;               ///< Hash of metrics and alpha
+	bool valid;                       ///< Whether the glyph was rendered
+};
+
+/** @brief Hash data (FNV-1a)
+ *  @param[in] data Data to hash
+ *  @param[in] size Data size
+ *  @param[in] hash Initial hash
+ *  @returns hash
+ */
+std::uint64_t hashData (const void *data, std::size_t size, std::uint64_t hash)
+{
+	const std::uint8_t *p = static_cast<const std::uint8_t *> (data);
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		hash ^= p[i];
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+/** @brief Glyph render time histogram bucket */
+struct RenderBucket
+{
+	std::int64_t limit; ///< Upper bound (microseconds, exclusive)
+	const char *name;   ///< Counter name
+};
+
+/** @brief Glyph render time histogram */
+const RenderBucket renderBuckets[] = {
+    {10, "glyphs < 10 us"},
+    {100, "glyphs < 100 us"},
+    {1000, "glyphs < 1 ms"},
+    {10000, "glyphs < 10 ms"},
+    {std::numeric_limits<std::int64_t>::max (), "glyphs >= 10 ms"},
+};
+
+/** @brief Record glyph render time
+ *  @param[in] duration Render time
+ */
+void recordRenderTime (stats::Clock::duration duration)
+{
+	const std::int64_t us =
+	    std::chrono::duration_cast<std::chrono::microseconds> (duration).count ();
+
+	stats::addTime ("glyph render (all threads)", duration);
+	for (const auto &bucket : renderBuckets)
+	{
+		if (us < bucket.limit)
+		{
+			stats::addCount (bucket.name, 1);
+			break;
+		}
+	}
+}
+
+/** @brief Check whether two rendered glyphs are identical
+ *  @param[in] lhs Left-hand side
+ *  @param[in] rhs Right-hand side
+ */
+bool sameGlyph (const RenderedGlyph &lhs, const RenderedGlyph &rhs)
+{
+	return lhs.hash == rhs.hash && lhs.glyph.info.left == rhs.glyph.info.left &&
+	       lhs.glyph.info.glyphWidth == rhs.glyph.info.glyphWidth &&
+	       lhs.glyph.info.charWidth == rhs.glyph.info.charWidth &&
+	       lhs.glyph.ascent == rhs.glyph.ascent &&
+	       lhs.glyph.img.columns () == rhs.glyph.img.columns () &&
+	       lhs.glyph.img.rows () == rhs.glyph.img.rows () && lhs.glyph.alpha == rhs.glyph.alpha;
+}
+
 std::vector<std::uint8_t>::iterator &operator<< (std::vector<std::uint8_t>::iterator &it,
     const char *str)
 {
@@ -349,35 +543,123 @@ void BCFNT::addFont (std::shared_ptr<freetype::Face> face_,
 	ascent  = std::max (ascent, static_cast<std::uint8_t> (face->size->metrics.ascender >> 6));
 	descent = std::min (descent, static_cast<int> (face->size->metrics.descender) >> 6);
 
+	// extract mappings from font face; code points sharing a face glyph are rendered once
+	std::map<FT_UInt, std::vector<std::uint16_t>> faceGlyphs;
 	std::vector<std::shared_future<void>> futures;
 	std::mutex mutex;
 
-	// extract mappings from font face
-	FT_UInt faceIndex;
-	FT_ULong code = FT_Get_First_Char (face, &faceIndex);
-	while (faceIndex != 0)
 	{
-		// only supports 16-bit code points; also 0xFFFF is explicitly a non-character
-		if (code >= std::numeric_limits<std::uint16_t>::max () || glyphs.count (code))
+		stats::ScopedTimer timer ("charmap");
+
+		if (isBlacklist)
 		{
-			code = FT_Get_Next_Char (face, code, &faceIndex);
-			continue;
-		}
+			FT_UInt faceIndex;
+			FT_ULong code = FT_Get_First_Char (face, &faceIndex);
+			while (faceIndex != 0)
+			{
+				// only supports 16-bit code points; also 0xFFFF is explicitly a non-character
+				if (code < std::numeric_limits<std::uint16_t>::max () && !hasCode (code) &&
+				    allowed (code, list, isBlacklist))
+					faceGlyphs[faceIndex].emplace_back (code);
 
-		FT_Error error = FT_Load_Glyph (face, faceIndex, FT_LOAD_DEFAULT);
-		if (error)
+				code = FT_Get_Next_Char (face, code, &faceIndex);
+			}
+		}
+		else
 		{
-			std::fprintf (stderr, "FT_Load_Glyph: %s\n", freetype::strerror (error));
+			// look up the whitelisted code points directly rather than walking the whole charmap
+			static constexpr std::size_t LOOKUP_CHUNK = 256;
 
-			code = FT_Get_Next_Char (face, code, &faceIndex);
-			continue;
+			std::vector<std::uint16_t> codes;
+			for (const auto &code : list)
+			{
+				if (code != 0xFFFF && !hasCode (code) && (codes.empty () || codes.back () != code))
+					codes.emplace_back (code);
+			}
+
+			std::vector<std::vector<std::pair<FT_UInt, std::uint16_t>>> found (
+			    (codes.size () + LOOKUP_CHUNK - 1) / LOOKUP_CHUNK);
+
+			for (std::size_t i = 0; i < found.size (); ++i)
+			{
+				auto job = [i, &codes, &found, &face_]() {
+					auto face = face_->getFace ();
+
+					const std::size_t end = std::min (codes.size (), (i + 1) * LOOKUP_CHUNK);
+					for (std::size_t j = i * LOOKUP_CHUNK; j < end; ++j)
+					{
+						const FT_UInt faceIndex = FT_Get_Char_Index (face, codes[j]);
+						if (faceIndex != 0)
+							found[i].emplace_back (faceIndex, codes[j]);
+					}
+				};
+
+				futures.emplace_back (ThreadPool::enqueue (job));
+			}
+
+			for (auto &future : futures)
+				future.wait ();
+
+			futures.clear ();
+
+			for (const auto &chunk : found)
+			{
+				for (const auto &pair : chunk)
+					faceGlyphs[pair.first].emplace_back (pair.second);
+			}
+		}
+	}
+
+	std::vector<RenderedGlyph> rendered (faceGlyphs.size ());
+
+	{
+		stats::ScopedTimer timer ("render");
+
+		// register the histogram in bucket order
+		if (stats::enabled)
+		{
+			for (const auto &bucket : renderBuckets)
+				stats::addCount (bucket.name, 0);
 		}
 
-		if (allowed (code, list, isBlacklist) && !glyphs.count (code))
+		for (const auto &pair : faceGlyphs)
 		{
-			auto job = [=, &mutex, &face_, &descent]() {
-				auto face  = face_->getFace ();
-				auto glyph = renderGlyph (face, faceIndex);
+			auto &out = rendered[futures.size ()];
+
+			out.codes = pair.second;
+			out.valid = false;
+
+			const FT_UInt faceIndex = pair.first;
+
+			auto job = [=, &out, &mutex, &face_, &descent]() {
+				const auto start = stats::Clock::now ();
+
+				auto face = face_->getFace ();
+
+				FT_Error error = FT_Load_Glyph (face, faceIndex, FT_LOAD_DEFAULT);
+				if (error)
+				{
+					std::fprintf (stderr, "FT_Load_Glyph: %s\n", freetype::strerror (error));
+					return;
+				}
+
+				out.glyph = renderGlyph (face, faceIndex);
+
+				// hash metrics and alpha to find identical glyphs
+				const auto &bitmap = face->glyph->bitmap;
+				const std::int32_t metrics[] = {out.glyph.info.left,
+				    out.glyph.info.glyphWidth,
+				    out.glyph.info.charWidth,
+				    out.glyph.ascent,
+				    static_cast<std::int32_t> (bitmap.width),
+				    static_cast<std::int32_t> (bitmap.rows)};
+
+				out.hash  = hashData (metrics, sizeof (metrics), 0xCBF29CE484222325ULL);
+				out.hash  = hashData (out.glyph.alpha.data (), out.glyph.alpha.size (), out.hash);
+				out.valid = true;
+
+				if (stats::enabled)
+					recordRenderTime (stats::Clock::now () - start);
 
 				std::unique_lock<std::mutex> lock (mutex);
 
@@ -385,18 +667,56 @@ void BCFNT::addFont (std::shared_ptr<freetype::Face> face_,
 				descent =
 				    std::min<int> (descent, face->glyph->bitmap_top - face->glyph->bitmap.rows);
 				maxWidth = std::max<std::uint8_t> (maxWidth, face->glyph->bitmap.width);
-
-				glyphs.emplace (code, glyph);
 			};
 
 			futures.emplace_back (ThreadPool::enqueue (job));
 		}
 
-		code = FT_Get_Next_Char (face, code, &faceIndex);
+		for (auto &future : futures)
+			future.wait ();
 	}
 
-	for (auto &future : futures)
-		future.wait ();
+	// visit glyphs in code point order so the lowest code point owns each glyph
+	std::vector<const RenderedGlyph *> order;
+	for (const auto &glyph : rendered)
+	{
+		if (glyph.valid)
+			order.emplace_back (&glyph);
+	}
+
+	std::sort (std::begin (order),
+	    std::end (order),
+	    [](const RenderedGlyph *lhs, const RenderedGlyph *rhs) {
+		    return lhs->codes.front () < rhs->codes.front ();
+	    });
+
+	// identical glyphs share one glyph index
+	std::unordered_multimap<std::uint64_t, const RenderedGlyph *> unique;
+	for (const auto &glyph : order)
+	{
+		std::uint16_t owner = glyph->codes.front ();
+
+		auto range = unique.equal_range (glyph->hash);
+		auto match = std::find_if (range.first,
+		    range.second,
+		    [&](const std::pair<const std::uint64_t, const RenderedGlyph *> &pair) {
+			    return sameGlyph (*pair.second, *glyph);
+		    });
+
+		if (match != range.second)
+			owner = match->second->codes.front ();
+		else
+		{
+			glyphs.emplace (owner, glyph->glyph);
+			unique.emplace (glyph->hash, glyph);
+		}
+
+		for (const auto &code : glyph->codes)
+		{
+			if (code != owner)
+				aliases.emplace (code, owner);
+		}
+	}
 
 	if (glyphs.empty ())
 		return;
@@ -405,25 +725,21 @@ void BCFNT::addFont (std::shared_ptr<freetype::Face> face_,
 	cellHeight     = std::max<int> (cellHeight, ascent - descent);
 	glyphWidth     = cellWidth + 1;
 	glyphHeight    = cellHeight + 1;
-	glyphsPerRow   = SHEET_WIDTH / glyphWidth;
-	glyphsPerCol   = SHEET_HEIGHT / glyphHeight;
-	glyphsPerSheet = glyphsPerRow * glyphsPerCol;
 
 	// try to provide a replacement character
-	if (glyphs.count (0xFFFD))
-		altIndex = std::distance (std::begin (glyphs), glyphs.find (0xFFFD));
-	else if (glyphs.count ('?'))
-		altIndex = std::distance (std::begin (glyphs), glyphs.find ('?'));
-	else if (glyphs.count (' '))
-		altIndex = std::distance (std::begin (glyphs), glyphs.find (' '));
+	if (hasCode (0xFFFD))
+		altIndex = glyphIndex (0xFFFD);
+	else if (hasCode ('?'))
+		altIndex = glyphIndex ('?');
+	else if (hasCode (' '))
+		altIndex = glyphIndex (' ');
 	else
 		altIndex = 0;
 
 	// collect character mappings
+	stats::ScopedTimer timer ("cmap");
 	refreshCMAPs ();
 
-	numSheets = (glyphs.size () - 1) / glyphsPerSheet + 1;
-
 	coalesceCMAP (cmaps);
 }
 
@@ -557,7 +873,10 @@ BCFNT::BCFNT (const std::vector<std::uint8_t> &data)
 	assert (SHEET_HEIGHT / glyphHeight == glyphsPerCol);
 	input >> in32; // Sheet Offset
 	input = std::begin (data) + in32;
-	readGlyphImages (input, numSheets);
+
+	// several character codes may share a glyph index
+	const auto indexCodes = codesByIndex (cmaps);
+	readGlyphImages (input, numSheets, indexCodes);
 
 	while (cwdhOffset != 0)
 	{
@@ -574,18 +893,29 @@ BCFNT::BCFNT (const std::vector<std::uint8_t> &data)
 		input >> cwdhOffset;
 		assert (in16 <= glyphs.size ());
 		for (std::uint16_t glyph = startIndex; glyph < in16; ++glyph)
-			input >> glyphs[codepoint (glyph)].info;
+		{
+			auto codes = indexCodes.find (glyph);
+			if (codes != std::end (indexCodes))
+				input >> glyphs[codes->second.front ()].info;
+			else
+				input += 3;
+		}
 	}
 }
 
-bool BCFNT::serialize (const std::string &path)
+bool BCFNT::serialize (const std::string &path, Compression compression)
 {
+	stats::ScopedTimer timer ("serialize");
+
 	if (glyphs.empty ())
 	{
 		std::fprintf (stderr, "Empty font\n");
 		return false;
 	}
 
+	if (!layoutSheets ())
+		return false;
+
 	std::vector<Magick::Image> sheetImages = sheetify ();
 
 	std::vector<std::uint8_t> output;
@@ -695,19 +1025,23 @@ bool BCFNT::serialize (const std::string &path)
 
 	assert (std::distance (std::begin (output), it) == sheetOffset);
 
-	std::vector<std::shared_future<void>> futures;
-
-	for (auto &sheet : sheetImages)
 	{
-		auto job = [&, it]() { appendSheet (it, sheet); };
+		stats::ScopedTimer timer ("sheet pack");
 
-		futures.emplace_back (ThreadPool::enqueue (job));
+		std::vector<std::shared_future<void>> futures;
 
-		std::advance (it, SHEET_SIZE);
-	}
+		for (auto &sheet : sheetImages)
+		{
+			auto job = [&, it]() { appendSheet (it, sheet); };
 
-	for (auto &future : futures)
-		future.wait ();
+			futures.emplace_back (ThreadPool::enqueue (job));
+
+			std::advance (it, SHEET_SIZE);
+		}
+
+		for (auto &future : futures)
+			future.wait ();
+	}
 
 	// CWDH header + data
 	assert (std::distance (std::begin (output), it) == cwdhOffset);
@@ -801,6 +1135,38 @@ bool BCFNT::serialize (const std::string &path)
 	assert (std::distance (std::begin (output), it) == fileSize);
 	assert (it == std::end (output));
 
+	if (compression != COMPRESSION_NONE)
+	{
+		stats::ScopedTimer timer ("compress");
+
+		const bool lz11 = compression == COMPRESSION_LZ11;
+
+		std::vector<std::uint8_t> compressed;
+		if (lz11)
+			compressed = lz11ParallelEncode (output.data (), output.size ());
+		else
+			compressed = lzssParallelEncode (output.data (), output.size ());
+
+		// verify the compressed stream before writing it
+		const std::size_t headerSize = (compressed[0] & 0x80) ? 8 : 4;
+
+		std::vector<std::uint8_t> check (output.size ());
+		if (lz11)
+			lz11Decode (&compressed[headerSize], check.data (), check.size ());
+		else
+			lzssDecode (&compressed[headerSize], check.data (), check.size ());
+
+		if (check != output)
+		{
+			std::fprintf (stderr, "Compressed font failed verification\n");
+			return false;
+		}
+
+		output.swap (compressed);
+	}
+
+	stats::ScopedTimer writeTimer ("write");
+
 	FILE *fp = std::fopen (path.c_str (), "wb");
 	if (!fp)
 		return false;
@@ -832,12 +1198,430 @@ bool BCFNT::serialize (const std::string &path)
 		return false;
 	}
 
-	std::printf ("Generated font with %zu glyphs\n", glyphs.size ());
+	std::printf ("Generated font with %zu glyphs for %zu characters on %u %ux%u sheets\n",
+	    glyphs.size (),
+	    glyphs.size () + aliases.size (),
+	    numSheets,
+	    SHEET_WIDTH,
+	    SHEET_HEIGHT);
+	return true;
+}
+
+bool BCFNT::verify (const std::string &path) const
+{
+	stats::ScopedTimer timer ("verify");
+
+	// only report the first few mismatches of each kind
+	static constexpr std::size_t MAX_REPORTS = 10;
+
+	std::vector<std::uint8_t> data;
+	if (!readFile (path, data))
+		return false;
+
+	// undo compression
+	if (data.size () >= 4 && ((data[0] & 0x7F) == 0x10 || (data[0] & 0x7F) == 0x11))
+	{
+		const std::size_t headerSize = (data[0] & 0x80) ? 8 : 4;
+		if (data.size () < headerSize)
+		{
+			std::fprintf (stderr, "%s: Truncated compression header\n", path.c_str ());
+			return false;
+		}
+
+		std::size_t size = data[1] | (data[2] << 8) | (data[3] << 16);
+		if (headerSize == 8)
+			size |= static_cast<std::size_t> (data[4]) << 24;
+
+		std::vector<std::uint8_t> decoded (size);
+		if ((data[0] & 0x7F) == 0x11)
+			lz11Decode (&data[headerSize], decoded.data (), decoded.size ());
+		else
+			lzssDecode (&data[headerSize], decoded.data (), decoded.size ());
+
+		data.swap (decoded);
+	}
+
+	if (data.size () < 0x14 + 0x20 + 0x20 || std::memcmp (data.data (), "CFNT", 4) != 0)
+	{
+		std::fprintf (stderr, "%s: Not a BCFNT\n", path.c_str ());
+		return false;
+	}
+
+	std::size_t failures = 0;
+	auto mismatch = [&](const char *what, unsigned actual, unsigned expected) {
+		std::fprintf (stderr, "%s: %s is %u, expected %u\n", path.c_str (), what, actual, expected);
+		++failures;
+	};
+
+	// FINF
+	std::uint8_t in8;
+	std::uint16_t in16;
+	std::uint32_t in32;
+	CharWidthInfo info;
+
+	std::vector<std::uint8_t>::const_iterator input = data.cbegin () + 0x14 + 8;
+	input += 1; // font type
+	input >> in8;
+	if (in8 != lineFeed)
+		mismatch ("line feed", in8, lineFeed);
+	input >> in16;
+	if (in16 != altIndex)
+		mismatch ("alternate index", in16, altIndex);
+	input >> info;
+	input += 1; // encoding
+
+	std::uint32_t tglpOffset;
+	std::uint32_t cwdhOffset;
+	std::uint32_t cmapOffset;
+	input >> tglpOffset >> cwdhOffset >> cmapOffset;
+	input >> in8;
+	if (in8 != height)
+		mismatch ("height", in8, height);
+	input >> in8;
+	if (in8 != width)
+		mismatch ("width", in8, width);
+	input >> in8;
+	if (in8 != ascent)
+		mismatch ("ascent", in8, ascent);
+
+	// TGLP; the sheets can't be compared if their layout differs
+	if (tglpOffset + 0x18 > data.size ())
+	{
+		std::fprintf (stderr, "%s: Truncated TGLP\n", path.c_str ());
+		return false;
+	}
+
+	input = data.cbegin () + tglpOffset;
+
+	std::uint8_t cells[4];
+	std::uint16_t layout[6];
+	input >> cells[0] >> cells[1] >> cells[2] >> cells[3] >> in32;
+	for (auto &value : layout)
+		input >> value;
+
+	if (cells[2] != ascent)
+		mismatch ("baseline", cells[2], ascent);
+	if (cells[3] != maxWidth)
+		mismatch ("max width", cells[3], maxWidth);
+
+	const std::size_t layoutFailures = failures;
+	if (cells[0] != cellWidth)
+		mismatch ("cell width", cells[0], cellWidth);
+	if (cells[1] != cellHeight)
+		mismatch ("cell height", cells[1], cellHeight);
+	if (in32 != SHEET_SIZE)
+		mismatch ("sheet size", in32, SHEET_SIZE);
+	if (layout[0] != numSheets)
+		mismatch ("number of sheets", layout[0], numSheets);
+	if (layout[1] != 0xB)
+		mismatch ("sheet format", layout[1], 0xB);
+	if (layout[2] != glyphsPerRow)
+		mismatch ("glyphs per row", layout[2], glyphsPerRow);
+	if (layout[3] != glyphsPerCol)
+		mismatch ("glyphs per column", layout[3], glyphsPerCol);
+	if (layout[4] != SHEET_WIDTH)
+		mismatch ("sheet width", layout[4], SHEET_WIDTH);
+	if (layout[5] != SHEET_HEIGHT)
+		mismatch ("sheet height", layout[5], SHEET_HEIGHT);
+
+	std::uint32_t sheetOffset;
+	input >> sheetOffset;
+	if (failures != layoutFailures ||
+	    sheetOffset + static_cast<std::size_t> (numSheets) * SHEET_SIZE > data.size ())
+	{
+		std::fprintf (stderr, "%s: Sheet layout differs; glyphs not compared\n", path.c_str ());
+		return false;
+	}
+
+	// glyphs in index order
+	std::vector<const Glyph *> order;
+	for (const auto &pair : glyphs)
+		order.emplace_back (&pair.second);
+
+	// compare each row of cells in parallel
+	std::vector<std::vector<CellMismatch>> rowMismatches (numSheets * glyphsPerCol);
+	std::vector<std::shared_future<void>> futures;
+	for (unsigned sheet = 0; sheet < numSheets; ++sheet)
+	{
+		for (unsigned row = 0; row < glyphsPerCol; ++row)
+		{
+			auto job = [&, sheet, row]() {
+				const std::uint8_t *sheetData = &data[sheetOffset + sheet * SHEET_SIZE];
+				auto &out = rowMismatches[sheet * glyphsPerCol + row];
+
+				for (unsigned col = 0; col < glyphsPerRow; ++col)
+				{
+					const std::uint32_t index =
+					    sheet * glyphsPerSheet + row * glyphsPerRow + col;
+					const Glyph *glyph = index < order.size () ? order[index] : nullptr;
+
+					// glyph position within the cell; empty cells must stay clear
+					int gx = 0, gy = 0, gw = 0, gh = 0;
+					if (glyph && !glyph->alpha.empty ())
+					{
+						gx = 1;
+						gy = 1 + ascent - glyph->ascent;
+						gw = glyph->img.columns ();
+						gh = glyph->alpha.size () / gw;
+					}
+
+					std::uint32_t pixels = 0;
+					for (int y = 0; y < glyphHeight; ++y)
+					{
+						for (int x = 0; x < glyphWidth; ++x)
+						{
+							std::uint8_t expected = 0;
+							if (x >= gx && x < gx + gw && y >= gy && y < gy + gh)
+							{
+								expected = quantum_to_bits<4> (bits_to_quantum<8> (
+								    glyph->alpha[(y - gy) * gw + (x - gx)]));
+							}
+
+							if (sheetAlpha (sheetData,
+							        SHEET_WIDTH,
+							        col * glyphWidth + x,
+							        row * glyphHeight + y) != expected)
+								++pixels;
+						}
+					}
+
+					if (pixels)
+						out.emplace_back (CellMismatch{index, pixels});
+				}
+			};
+
+			futures.emplace_back (ThreadPool::enqueue (job));
+		}
+	}
+
+	// character code of each glyph index
+	std::vector<std::uint16_t> codes;
+	for (const auto &pair : glyphs)
+		codes.emplace_back (pair.first);
+
+	// CWDH, while the sheets are compared
+	std::size_t widthFailures = 0;
+	std::uint32_t widthCount  = 0;
+	while (cwdhOffset != 0)
+	{
+		if (cwdhOffset + 8 > data.size ())
+		{
+			std::fprintf (stderr, "%s: Truncated CWDH\n", path.c_str ());
+			++widthFailures;
+			break;
+		}
+
+		input = data.cbegin () + cwdhOffset;
+
+		std::uint16_t startIndex;
+		std::uint16_t endIndex;
+		input >> startIndex >> endIndex >> cwdhOffset;
+		if (cwdhOffset == 0 && endIndex != order.size ())
+		{
+			std::fprintf (stderr,
+			    "%s: Widths end at glyph %u, expected %zu\n",
+			    path.c_str (),
+			    endIndex,
+			    order.size ());
+			++widthFailures;
+		}
+
+		for (unsigned index = startIndex; index < endIndex && index < order.size (); ++index)
+		{
+			if (static_cast<std::size_t> (std::distance (data.cbegin (), input)) + 3 >
+			    data.size ())
+				break;
+
+			input >> info;
+			++widthCount;
+
+			const auto &expected = order[index]->info;
+			if (info.left == expected.left && info.glyphWidth == expected.glyphWidth &&
+			    info.charWidth == expected.charWidth)
+				continue;
+
+			if (widthFailures++ < MAX_REPORTS)
+			{
+				std::fprintf (stderr,
+				    "%s: Glyph %u (U+%04X) widths are %d/%u/%u, expected %d/%u/%u\n",
+				    path.c_str (),
+				    index,
+				    codes[index],
+				    info.left,
+				    info.glyphWidth,
+				    info.charWidth,
+				    expected.left,
+				    expected.glyphWidth,
+				    expected.charWidth);
+			}
+		}
+	}
+
+	// CMAP; decode every mapping and compare against the glyphs and aliases
+	std::map<std::uint16_t, std::uint16_t> mapped;
+	while (cmapOffset != 0)
+	{
+		if (cmapOffset < 8 || cmapOffset + 12 > data.size ())
+		{
+			std::fprintf (stderr, "%s: Truncated CMAP\n", path.c_str ());
+			++failures;
+			break;
+		}
+
+		input = data.cbegin () + cmapOffset - 4;
+
+		std::uint32_t size;
+		std::uint16_t codeBegin;
+		std::uint16_t codeEnd;
+		std::uint16_t method;
+		input >> size >> codeBegin >> codeEnd >> method >> in16;
+
+		// mapping data must fit in the section
+		const std::size_t end = cmapOffset - 8 + static_cast<std::size_t> (size);
+		const std::size_t need =
+		    method == CMAPData::CMAP_TYPE_TABLE ? (codeEnd - codeBegin + 1u) * 2 : 4;
+
+		input >> cmapOffset;
+		if (codeEnd < codeBegin || end > data.size () ||
+		    static_cast<std::size_t> (std::distance (data.cbegin (), input)) + need > end)
+		{
+			std::fprintf (stderr, "%s: Invalid CMAP\n", path.c_str ());
+			++failures;
+			break;
+		}
+
+		switch (method)
+		{
+		case CMAPData::CMAP_TYPE_DIRECT:
+			input >> in16;
+			for (unsigned code = codeBegin; code <= codeEnd; ++code)
+				mapped.emplace (code, in16 + code - codeBegin);
+			break;
+
+		case CMAPData::CMAP_TYPE_TABLE:
+			for (unsigned code = codeBegin; code <= codeEnd; ++code)
+			{
+				input >> in16;
+				if (in16 != 0xFFFF)
+					mapped.emplace (code, in16);
+			}
+			break;
+
+		case CMAPData::CMAP_TYPE_SCAN:
+		{
+			std::uint16_t count;
+			input >> count;
+			if (static_cast<std::size_t> (std::distance (data.cbegin (), input)) + count * 4u > end)
+			{
+				std::fprintf (stderr, "%s: Invalid CMAP\n", path.c_str ());
+				++failures;
+				break;
+			}
+
+			for (unsigned entry = 0; entry < count; ++entry)
+			{
+				std::uint16_t code;
+				input >> code >> in16;
+				mapped.emplace (code, in16);
+			}
+			break;
+		}
+
+		default:
+			mismatch ("CMAP mapping method", method, CMAPData::CMAP_TYPE_SCAN);
+			break;
+		}
+	}
+
+	std::map<std::uint16_t, std::uint16_t> indices;
+	for (std::size_t index = 0; index < codes.size (); ++index)
+		indices.emplace (codes[index], index);
+	for (const auto &alias : aliases)
+		indices.emplace (alias.first, indices.at (alias.second));
+
+	std::size_t mapFailures = 0;
+	auto reportMapping = [&](std::uint16_t code, int actual, int expected) {
+		if (mapFailures++ >= MAX_REPORTS)
+			return;
+
+		std::fprintf (stderr,
+		    "%s: U+%04X maps to glyph %d, expected %d\n",
+		    path.c_str (),
+		    code,
+		    actual,
+		    expected);
+	};
+
+	for (const auto &pair : indices)
+	{
+		auto it = mapped.find (pair.first);
+		if (it == std::end (mapped))
+			reportMapping (pair.first, -1, pair.second);
+		else if (it->second != pair.second)
+			reportMapping (pair.first, it->second, pair.second);
+	}
+
+	for (const auto &pair : mapped)
+	{
+		if (!indices.count (pair.first))
+			reportMapping (pair.first, pair.second, -1);
+	}
+
+	for (auto &future : futures)
+		future.wait ();
+
+	std::size_t cellFailures = 0;
+	for (const auto &row : rowMismatches)
+	{
+		for (const auto &cell : row)
+		{
+			if (cellFailures++ >= MAX_REPORTS)
+				continue;
+
+			if (cell.index < codes.size ())
+			{
+				std::fprintf (stderr,
+				    "%s: Glyph %u (U+%04X) differs in %u pixels\n",
+				    path.c_str (),
+				    cell.index,
+				    codes[cell.index],
+				    cell.pixels);
+			}
+			else
+			{
+				std::fprintf (stderr,
+				    "%s: Unused cell %u has %u pixels set\n",
+				    path.c_str (),
+				    cell.index,
+				    cell.pixels);
+			}
+		}
+	}
+
+	if (failures || cellFailures || widthFailures || mapFailures)
+	{
+		std::fprintf (stderr,
+		    "%s: Verification failed: %zu header fields, %zu cells, %zu widths and %zu "
+		    "character mappings differ\n",
+		    path.c_str (),
+		    failures,
+		    cellFailures,
+		    widthFailures,
+		    mapFailures);
+		return false;
+	}
+
+	std::printf ("Verified %zu glyphs, %u widths and %zu character mappings\n",
+	    order.size (),
+	    widthCount,
+	    mapped.size ());
 	return true;
 }
 
 std::vector<Magick::Image> BCFNT::sheetify ()
 {
+	stats::ScopedTimer timer ("sheetify");
+
 	std::vector<std::map<std::uint16_t, Glyph>::const_iterator> iters;
 	{
 		auto it = std::begin (glyphs);
@@ -889,19 +1673,23 @@ std::vector<Magick::Image> BCFNT::sheetify ()
 	return sheets;
 }
 
-std::uint16_t BCFNT::codepoint (std::uint16_t index) const
+bool BCFNT::hasCode (std::uint16_t code) const
 {
-	for (auto &cmap : cmaps)
-	{
-		std::uint16_t code = cmap.codePointFromIndex (index);
-		if (code != 0xFFFF)
-			return code;
-	}
+	return glyphs.count (code) || aliases.count (code);
+}
+
+std::uint16_t BCFNT::glyphIndex (std::uint16_t code) const
+{
+	auto alias = aliases.find (code);
+	if (alias != std::end (aliases))
+		code = alias->second;
 
-	return 0xFFFF;
+	return std::distance (std::begin (glyphs), glyphs.find (code));
 }
 
-void BCFNT::readGlyphImages (std::vector<std::uint8_t>::const_iterator &it, int numSheets)
+void BCFNT::readGlyphImages (std::vector<std::uint8_t>::const_iterator &it,
+    int numSheets,
+    const std::map<std::uint16_t, std::vector<std::uint16_t>> &indexCodes)
 {
 	for (int sheet = 0; sheet < numSheets; ++sheet)
 	{
@@ -918,18 +1706,32 @@ void BCFNT::readGlyphImages (std::vector<std::uint8_t>::const_iterator &it, int
 				Magick::Image glyph (Magick::Geometry (glyphWidth, glyphHeight), transparent ());
 				glyph.magick ("A");
 
+				std::vector<std::uint8_t> alpha (glyphWidth * glyphHeight);
+
 				Pixels glyphPixels (glyph);
 				PixelPacket outData = glyphPixels.get (0, 0, cellWidth, cellHeight);
 				for (unsigned pixel = 0; pixel < cellWidth * cellHeight; ++pixel)
+				{
 					outData[pixel] = glyphData[pixel];
+					alpha[pixel / cellWidth * glyphWidth + pixel % cellWidth] =
+					    quantum_to_bits<8> (quantumAlpha (glyphData[pixel]));
+				}
 
 				glyphPixels.sync ();
 
-				const std::uint16_t code =
-				    codepoint (sheet * glyphsPerSheet + y * glyphsPerRow + x);
+				auto codes = indexCodes.find (sheet * glyphsPerSheet + y * glyphsPerRow + x);
+				if (codes == std::end (indexCodes))
+					continue;
 
-				if (code != 0xFFFF)
-					glyphs.emplace (code, Glyph{glyph, bcfnt::CharWidthInfo{0, 0, 0}, ascent});
+				// the lowest code owns the glyph; the rest share it
+				const std::uint16_t owner = codes->second.front ();
+				glyphs.emplace (owner,
+				    Glyph{glyph, bcfnt::CharWidthInfo{0, 0, 0}, ascent, std::move (alpha)});
+				for (const auto &code : codes->second)
+				{
+					if (code != owner)
+						aliases.emplace (code, owner);
+				}
 			}
 		}
 	}
@@ -939,12 +1741,27 @@ void BCFNT::refreshCMAPs ()
 {
 	cmaps.clear ();
 
-	std::uint16_t index = 0;
+	// glyph index of each character code; aliases use the index of the glyph they share
+	std::map<std::uint16_t, std::uint16_t> indices;
+
+	std::uint16_t next = 0;
 	for (const auto &pair : glyphs)
+		indices.emplace (pair.first, next++);
+
+	for (const auto &alias : aliases)
+		indices.emplace (alias.first, indices.at (alias.second));
+
+	// build direct maps for runs of consecutive codes and indices; short runs are later
+	// coalesced into a scan map
+	for (const auto &pair : indices)
 	{
-		const auto &code = pair.first;
+		const auto &code  = pair.first;
+		const auto &index = pair.second;
 
-		if (cmaps.empty () || cmaps.back ().codeEnd != code - 1)
+		if (cmaps.empty () || cmaps.back ().codeEnd != code - 1 ||
+		    dynamic_cast<const CMAPDirect &> (*cmaps.back ().data).offset + code -
+		            cmaps.back ().codeBegin !=
+		        index)
 		{
 			cmaps.emplace_back ();
 			auto &cmap = cmaps.back ();
@@ -955,8 +1772,6 @@ void BCFNT::refreshCMAPs ()
 		}
 		else
 			cmaps.back ().codeEnd = code;
-
-		++index;
 	}
 }
 
@@ -967,12 +1782,40 @@ void BCFNT::addFont (BCFNT &other, std::vector<std::uint16_t> &list, bool isBlac
 	    newAscent + std::max (other.cellHeight - other.ascent, cellHeight - ascent);
 	std::uint8_t newCellWidth = std::max (other.cellWidth, cellWidth);
 
+	// other font's glyph code and the code that owns that glyph here
+	std::map<std::uint16_t, std::uint16_t> shared;
+
 	for (const auto &pair : other.glyphs)
 	{
 		const auto &code = pair.first;
 
-		if (code != 0xFFFF && !glyphs.count (code) && allowed (code, list, isBlacklist))
+		if (code != 0xFFFF && !hasCode (code) && allowed (code, list, isBlacklist))
+		{
 			glyphs.emplace (pair);
+			shared.emplace (code, code);
+		}
+	}
+
+	for (const auto &pair : other.aliases)
+	{
+		const auto &code = pair.first;
+
+		if (code == 0xFFFF || hasCode (code) || !allowed (code, list, isBlacklist))
+			continue;
+
+		auto owner = shared.find (pair.second);
+		if (owner != std::end (shared))
+			aliases.emplace (code, owner->second);
+		else
+		{
+			// the shared glyph was not taken from the other font; take a copy for this code
+			auto glyph = other.glyphs.find (pair.second);
+			if (glyph == std::end (other.glyphs))
+				continue;
+
+			glyphs.emplace (code, glyph->second);
+			shared.emplace (pair.second, code);
+		}
 	}
 
 	refreshCMAPs ();
@@ -982,13 +1825,101 @@ void BCFNT::addFont (BCFNT &other, std::vector<std::uint16_t> &list, bool isBlac
 	cellWidth      = newCellWidth;
 	glyphHeight    = cellHeight + 1;
 	glyphWidth     = cellWidth + 1;
-	glyphsPerRow   = SHEET_WIDTH / glyphWidth;
-	glyphsPerCol   = SHEET_HEIGHT / glyphHeight;
-	glyphsPerSheet = glyphsPerRow * glyphsPerCol;
 	lineFeed       = std::max (lineFeed, other.lineFeed);
 	height         = std::max (height, other.height);
 	width          = std::max (width, other.width);
 	maxWidth       = cellWidth;
-	numSheets      = (glyphs.size () - 1) / glyphsPerSheet + 1;
+}
+
+void BCFNT::setSheetSize (std::uint16_t width, std::uint16_t height)
+{
+	sheetWidth  = width;
+	sheetHeight = height;
+}
+
+bool BCFNT::layoutSheets ()
+{
+	stats::ScopedTimer timer ("sheet layout");
+
+	// sheets are A4 textures; both dimensions are powers of two in [8, 1024]
+	static constexpr unsigned MIN_DIM = 8;
+	static constexpr unsigned MAX_DIM = 1024;
+
+	// every sheet is a separate texture to bind, so automatic sheets are never tiny
+	static constexpr unsigned MIN_AUTO_DIM = 128;
+
+	/** @brief Candidate sheet layout */
+	struct Layout
+	{
+		unsigned width;       ///< Sheet width
+		unsigned height;      ///< Sheet height
+		std::uint64_t sheets; ///< Number of sheets
+		std::uint64_t bytes;  ///< Total size of the sheets
+	};
+
+	std::vector<Layout> layouts;
+	std::uint64_t minBytes = std::numeric_limits<std::uint64_t>::max ();
+
+	for (unsigned w = MIN_DIM; w <= MAX_DIM; w *= 2)
+	{
+		if (sheetWidth ? w != sheetWidth : w < MIN_AUTO_DIM)
+			continue;
+
+		for (unsigned h = MIN_DIM; h <= MAX_DIM; h *= 2)
+		{
+			if (sheetHeight ? h != sheetHeight : h < MIN_AUTO_DIM)
+				continue;
+
+			const unsigned perSheet = (w / glyphWidth) * (h / glyphHeight);
+			if (perSheet == 0)
+				continue;
+
+			const std::uint64_t sheets = (glyphs.size () - 1) / perSheet + 1;
+			const std::uint64_t bytes  = sheets * w * h / 2;
+			if (sheets > std::numeric_limits<std::uint16_t>::max ())
+				continue;
+
+			layouts.emplace_back (Layout{w, h, sheets, bytes});
+			minBytes = std::min (minBytes, bytes);
+		}
+	}
+
+	if (layouts.empty ())
+	{
+		std::fprintf (stderr,
+		    "Sheet size %ux%u cannot fit %ux%u glyph cells\n",
+		    sheetWidth,
+		    sheetHeight,
+		    glyphWidth,
+		    glyphHeight);
+		return false;
+	}
+
+	// fewest sheets within a quarter of the smallest total size, then the smallest and squarest
+	auto better = [](const Layout &a, const Layout &b) {
+		if (a.sheets != b.sheets)
+			return a.sheets < b.sheets;
+		if (a.bytes != b.bytes)
+			return a.bytes < b.bytes;
+		return std::max (a.width, a.height) < std::max (b.width, b.height);
+	};
+
+	const Layout *best = nullptr;
+	for (const auto &layout : layouts)
+	{
+		if (layout.bytes <= minBytes + minBytes / 4 && (!best || better (layout, *best)))
+			best = &layout;
+	}
+
+	SHEET_WIDTH  = best->width;
+	SHEET_HEIGHT = best->height;
+
+	SHEET_SIZE     = SHEET_WIDTH * SHEET_HEIGHT / 2;
+	glyphsPerRow   = SHEET_WIDTH / glyphWidth;
+	glyphsPerCol   = SHEET_HEIGHT / glyphHeight;
+	glyphsPerSheet = glyphsPerRow * glyphsPerCol;
+	numSheets      = best->sheets;
+
+	return true;
 }
 }
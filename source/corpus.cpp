@@ -0,0 +1,311 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2019
+ *     Michael Theall (mtheall)
+ *     piepie62
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file corpus.cpp
+ *  @brief Text corpus scanning
+ */
+
+#include "corpus.h"
+#include "threadPool.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <future>
+
+/** @brief Bytes decoded per job; a multiple of 2 to keep UTF-16 chunks aligned */
+#define CORPUS_CHUNK_SIZE 0x100000
+
+namespace
+{
+/** @brief Set of code points */
+typedef std::bitset<0x10000> CodeSet;
+
+/** @brief Text encoding */
+enum Encoding
+{
+	UTF8,
+	UTF16LE,
+	UTF16BE,
+};
+
+/** @brief Decoded text file */
+struct Text
+{
+	std::string path;          ///< File path
+	std::vector<uint8_t> data; ///< File contents
+	Encoding encoding;         ///< Text encoding
+	std::size_t start;         ///< Offset past the byte order mark
+};
+
+/** @brief Result of scanning a chunk */
+struct Chunk
+{
+	CodeSet codes;          ///< Code points used
+	std::size_t unmappable; ///< Characters outside the Basic Multilingual Plane
+};
+
+/** @brief Add a code point
+ *  @param[in]  code  Code point
+ *  @param[out] chunk Chunk result
+ */
+void addCode (std::uint32_t code, Chunk &chunk)
+{
+	if (code > 0xFFFF)
+	{
+		++chunk.unmappable;
+		return;
+	}
+
+	// skip control characters, surrogates, byte order marks and the invalid code 0xFFFF
+	if (code < 0x20 || (code >= 0x7F && code < 0xA0) || (code >= 0xD800 && code < 0xE000) ||
+	    code == 0xFEFF || code == 0xFFFF)
+		return;
+
+	chunk.codes.set (code);
+}
+
+/** @brief Decode UTF-8 characters starting in [begin, end)
+ *  @param[in]  text  Text file
+ *  @param[in]  begin Start offset
+ *  @param[in]  end   End offset
+ *  @param[out] chunk Chunk result
+ */
+void scanUTF8 (const Text &text, std::size_t begin, std::size_t end, Chunk &chunk)
+{
+	const std::uint8_t *data = text.data.data ();
+	const std::size_t size   = text.data.size ();
+
+	// the previous chunk finishes any character that straddles the boundary
+	while (begin < end && (data[begin] & 0xC0) == 0x80)
+		++begin;
+
+	std::size_t i = begin;
+	while (i < end)
+	{
+		const std::uint8_t c = data[i];
+
+		std::size_t len;
+		std::uint32_t code;
+		if (c < 0x80)
+		{
+			len  = 1;
+			code = c;
+		}
+		else if ((c & 0xE0) == 0xC0)
+		{
+			len  = 2;
+			code = c & 0x1F;
+		}
+		else if ((c & 0xF0) == 0xE0)
+		{
+			len  = 3;
+			code = c & 0x0F;
+		}
+		else if ((c & 0xF8) == 0xF0)
+		{
+			len  = 4;
+			code = c & 0x07;
+		}
+		else
+		{
+			// stray continuation or invalid lead byte
+			++i;
+			continue;
+		}
+
+		if (i + len > size)
+			break;
+
+		bool valid = true;
+		for (std::size_t j = 1; j < len; ++j)
+		{
+			if ((data[i + j] & 0xC0) != 0x80)
+			{
+				valid = false;
+				break;
+			}
+
+			code = (code << 6) | (data[i + j] & 0x3F);
+		}
+
+		if (!valid)
+		{
+			++i;
+			continue;
+		}
+
+		addCode (code, chunk);
+		i += len;
+	}
+}
+
+/** @brief Decode UTF-16 code units in [begin, end)
+ *  @param[in]  text  Text file
+ *  @param[in]  begin Start offset
+ *  @param[in]  end   End offset
+ *  @param[out] chunk Chunk result
+ */
+void scanUTF16 (const Text &text, std::size_t begin, std::size_t end, Chunk &chunk)
+{
+	const std::uint8_t *data = text.data.data ();
+	const bool bigEndian     = text.encoding == UTF16BE;
+
+	for (std::size_t i = begin; i < end && i + 1 < text.data.size (); i += 2)
+	{
+		const std::uint16_t unit = bigEndian ? (data[i] << 8) | data[i + 1]
+		                                     : (data[i + 1] << 8) | data[i];
+
+		// a surrogate pair encodes a character outside the Basic Multilingual Plane; count it
+		// once by its high surrogate
+		if (unit >= 0xD800 && unit < 0xDC00)
+			++chunk.unmappable;
+		else
+			addCode (unit, chunk);
+	}
+}
+
+/** @brief Read a text file
+ *  @param[in]  path File path
+ *  @param[out] text Text file
+ *  @returns whether successful
+ */
+bool readText (const std::string &path, Text &text)
+{
+	FILE *fp = std::fopen (path.c_str (), "rb");
+	if (!fp)
+	{
+		std::fprintf (stderr, "Error opening corpus file '%s': %s\n", path.c_str (), std::strerror (errno));
+		return false;
+	}
+
+	text.path = path;
+	text.data.clear ();
+
+	std::uint8_t buffer[0x10000];
+	std::size_t rc;
+	while ((rc = std::fread (buffer, 1, sizeof (buffer), fp)) > 0)
+		text.data.insert (std::end (text.data), buffer, buffer + rc);
+
+	if (std::ferror (fp))
+	{
+		std::fprintf (stderr, "Error while reading corpus file %s\n", path.c_str ());
+		std::fclose (fp);
+		return false;
+	}
+
+	std::fclose (fp);
+
+	const auto &data = text.data;
+	if (data.size () >= 2 && data[0] == 0xFF && data[1] == 0xFE)
+	{
+		text.encoding = UTF16LE;
+		text.start    = 2;
+	}
+	else if (data.size () >= 2 && data[0] == 0xFE && data[1] == 0xFF)
+	{
+		text.encoding = UTF16BE;
+		text.start    = 2;
+	}
+	else if (data.size () >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF)
+	{
+		text.encoding = UTF8;
+		text.start    = 3;
+	}
+	else
+	{
+		text.encoding = UTF8;
+		text.start    = 0;
+	}
+
+	return true;
+}
+}
+
+bool corpus::scan (const std::vector<std::string> &paths, std::vector<std::uint16_t> &codes)
+{
+	// read all files up front; decoding is split into chunks across the thread pool
+	std::vector<Text> texts (paths.size ());
+	for (std::size_t i = 0; i < paths.size (); ++i)
+	{
+		if (!readText (paths[i], texts[i]))
+			return false;
+	}
+
+	std::vector<std::pair<const Text *, std::size_t>> jobs;
+	for (const auto &text : texts)
+	{
+		for (std::size_t begin = text.start; begin < text.data.size (); begin += CORPUS_CHUNK_SIZE)
+			jobs.emplace_back (&text, begin);
+	}
+
+	std::vector<Chunk> chunks (jobs.size ());
+
+	std::vector<std::shared_future<void>> futures;
+	futures.reserve (jobs.size ());
+	for (std::size_t i = 0; i < jobs.size (); ++i)
+	{
+		auto job = [&jobs, &chunks, i]() {
+			const Text &text        = *jobs[i].first;
+			const std::size_t begin = jobs[i].second;
+			const std::size_t end   = std::min (begin + CORPUS_CHUNK_SIZE, text.data.size ());
+
+			Chunk &chunk     = chunks[i];
+			chunk.unmappable = 0;
+
+			if (text.encoding == UTF8)
+				scanUTF8 (text, begin, end, chunk);
+			else
+				scanUTF16 (text, begin, end, chunk);
+		};
+
+		futures.emplace_back (ThreadPool::enqueue (job));
+	}
+
+	for (auto &future : futures)
+		future.wait ();
+
+	CodeSet used;
+	std::size_t unmappable = 0;
+	for (const auto &chunk : chunks)
+	{
+		used |= chunk.codes;
+		unmappable += chunk.unmappable;
+	}
+
+	codes.clear ();
+	for (std::uint32_t code = 0; code < used.size (); ++code)
+	{
+		if (used.test (code))
+			codes.emplace_back (code);
+	}
+
+	if (unmappable)
+	{
+		std::fprintf (stderr,
+		    "Warning: ignored %zu corpus characters outside the Basic Multilingual Plane\n",
+		    unmappable);
+	}
+
+	std::printf ("Corpus uses %zu code points from %zu files\n", codes.size (), paths.size ());
+	return true;
+}
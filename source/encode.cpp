@@ -22,20 +22,63 @@
  */
 
 #include "encode.h"
+#include "etc1_fast.h"
 #include "quantum.h"
 #include "rg_etc1.h"
+#include "stats.h"
 
 namespace
 {
+/** @brief ETC1 cache variant for the fast encoder; rg_etc1 uses its quality level */
+const uint32_t ETC1_FAST_VARIANT = 0x100;
+
+/** @brief Compute squared error of packed ETC1 block
+ *  @param[in] rgba  4x4 RGBA input block
+ *  @param[in] block Packed ETC1 block
+ *  @returns squared error
+ */
+unsigned etc1_error (const uint8_t *rgba, const uint8_t *block)
+{
+	uint8_t unpacked[4 * 4 * 4];
+	rg_etc1::unpack_etc1_block (block, reinterpret_cast<unsigned *> (unpacked));
+
+	unsigned error = 0;
+	for (size_t i = 0; i < 4 * 4; ++i)
+	{
+		for (size_t c = 0; c < 3; ++c)
+		{
+			const int d = unpacked[i * 4 + c] - rgba[i * 4 + c];
+			error += d * d;
+		}
+	}
+
+	return error;
+}
+
 /** @brief ETC1/ETC1A4 encoder
- *  @param[in] work  Work unit
- *  @param[in] alpha Whether to output alpha data
+ *  @tparam    alpha   Whether to output alpha data
+ *  @tparam    output  Whether to output 3DS data
+ *  @tparam    preview Whether to output preview image
+ *  @param[in] work    Work unit
  */
-void etc1_common (encode::WorkUnit &work, bool alpha)
+template <bool alpha, bool output, bool preview>
+void etc1_common (encode::WorkUnit &work)
 {
 	rg_etc1::etc1_pack_params params;
 	params.clear ();
-	params.m_quality = work.etc1_quality;
+	params.m_quality      = work.etc1_quality;
+	params.m_error_target = work.etc1_error_target;
+
+	// the error target changes rg_etc1 output, so it is part of the cache variant
+	const uint32_t variant =
+	    work.etc1_fast ? ETC1_FAST_VARIANT
+	                   : static_cast<uint32_t> (work.etc1_quality) | (work.etc1_error_target << 16);
+
+	// statistics for this tile
+	stats::Clock::duration pack_time = stats::Clock::duration::zero ();
+	uint64_t error                   = 0;
+	uint64_t reference_error         = 0;
+	uint64_t target_met              = 0;
 
 	for (size_t j = 0; j < 8; j += 4)
 	{
@@ -45,7 +88,7 @@ void etc1_common (encode::WorkUnit &work, bool alpha)
 			uint8_t out_block[8];
 			uint8_t out_alpha[8] = {0, 0, 0, 0, 0, 0, 0, 0};
 
-			if (work.output || work.preview)
+			if (output || preview)
 			{
 				// iterate each 4x4 subblock
 				for (size_t y = 0; y < 4; ++y)
@@ -59,7 +102,7 @@ void etc1_common (encode::WorkUnit &work, bool alpha)
 						in_block[y * 16 + x * 4 + 2] = quantum_to_bits<8> (quantumBlue (c));
 						in_block[y * 16 + x * 4 + 3] = 0xFF;
 
-						if (alpha && work.output)
+						if (alpha && output)
 						{
 							// encode 4bpp alpha; X/Y axes are swapped
 							if (y & 1)
@@ -72,12 +115,41 @@ void etc1_common (encode::WorkUnit &work, bool alpha)
 					}
 				}
 
-				// encode etc1 block
-				rg_etc1::pack_etc1_block (
-				    out_block, reinterpret_cast<unsigned *> (in_block), params);
+				// encode etc1 block unless it is already cached
+				if (!work.etc1_cache || !work.etc1_cache->lookup (in_block, variant, out_block))
+				{
+					const stats::Clock::time_point start =
+					    stats::enabled ? stats::Clock::now () : stats::Clock::time_point ();
+
+					if (work.etc1_fast)
+						etc1_fast::pack_etc1_block (out_block, in_block);
+					else if (rg_etc1::pack_etc1_block (
+					             out_block, reinterpret_cast<unsigned *> (in_block), params) <=
+					         work.etc1_error_target)
+						++target_met;
+
+					if (stats::enabled)
+						pack_time += stats::Clock::now () - start;
+
+					if (work.etc1_cache)
+						work.etc1_cache->insert (in_block, variant, out_block);
+				}
+
+				if (stats::enabled)
+				{
+					error += etc1_error (in_block, out_block);
+
+					// compare the fast encoder against rg_etc1
+					if (work.etc1_fast)
+					{
+						uint8_t reference_block[8];
+						reference_error += rg_etc1::pack_etc1_block (
+						    reference_block, reinterpret_cast<unsigned *> (in_block), params);
+					}
+				}
 			}
 
-			if (work.output)
+			if (output)
 			{
 				// alpha block precedes etc1 block
 				if (alpha)
@@ -91,7 +163,7 @@ void etc1_common (encode::WorkUnit &work, bool alpha)
 					work.result.push_back (out_block[8 - i - 1]);
 			}
 
-			if (work.preview)
+			if (preview)
 			{
 				rg_etc1::unpack_etc1_block (out_block, reinterpret_cast<unsigned *> (in_block));
 
@@ -119,12 +191,25 @@ void etc1_common (encode::WorkUnit &work, bool alpha)
 			}
 		}
 	}
-}
+
+	if (stats::enabled && (output || preview))
+	{
+		stats::addTime ("etc1 pack", pack_time);
+		stats::addCount ("etc1 blocks", 4);
+		stats::addCount ("etc1 squared error", error);
+		if (work.etc1_fast)
+			stats::addCount ("etc1 reference squared error", reference_error);
+		else if (work.etc1_error_target)
+			stats::addCount ("etc1 error target met", target_met);
+	}
 }
 
-namespace encode
-{
-void rgba8888 (WorkUnit &work)
+/* Tile encoders; see encode.h for the formats. Each is instantiated for every
+ * combination of output and preview so the per-pixel checks fold away.
+ */
+
+template <bool output, bool preview>
+void rgba8888_tile (encode::WorkUnit &work)
 {
 	for (size_t j = 0; j < 8; ++j)
 	{
@@ -132,7 +217,7 @@ void rgba8888 (WorkUnit &work)
 		{
 			Magick::Color c = work.p[j * work.stride + i];
 
-			if (work.output)
+			if (output)
 			{
 				work.result.push_back (quantum_to_bits<8> (quantumAlpha (c)));
 				work.result.push_back (quantum_to_bits<8> (quantumBlue (c)));
@@ -140,7 +225,7 @@ void rgba8888 (WorkUnit &work)
 				work.result.push_back (quantum_to_bits<8> (quantumRed (c)));
 			}
 
-			if (work.preview)
+			if (preview)
 			{
 				quantumRed (c, quantize<8> (quantumRed (c)));
 				quantumGreen (c, quantize<8> (quantumGreen (c)));
@@ -153,7 +238,8 @@ void rgba8888 (WorkUnit &work)
 	}
 }
 
-void rgb888 (WorkUnit &work)
+template <bool output, bool preview>
+void rgb888_tile (encode::WorkUnit &work)
 {
 	for (size_t j = 0; j < 8; ++j)
 	{
@@ -161,14 +247,14 @@ void rgb888 (WorkUnit &work)
 		{
 			Magick::Color c = work.p[j * work.stride + i];
 
-			if (work.output)
+			if (output)
 			{
 				work.result.push_back (quantum_to_bits<8> (quantumBlue (c)));
 				work.result.push_back (quantum_to_bits<8> (quantumGreen (c)));
 				work.result.push_back (quantum_to_bits<8> (quantumRed (c)));
 			}
 
-			if (work.preview)
+			if (preview)
 			{
 				using Magick::Quantum;
 
@@ -183,7 +269,8 @@ void rgb888 (WorkUnit &work)
 	}
 }
 
-void rgba5551 (WorkUnit &work)
+template <bool output, bool preview>
+void rgba5551_tile (encode::WorkUnit &work)
 {
 	for (size_t j = 0; j < 8; ++j)
 	{
@@ -191,7 +278,7 @@ void rgba5551 (WorkUnit &work)
 		{
 			Magick::Color c = work.p[j * work.stride + i];
 
-			if (work.output)
+			if (output)
 			{
 				uint16_t v = (quantum_to_bits<5> (quantumRed (c)) << 11) |
 				             (quantum_to_bits<5> (quantumGreen (c)) << 6) |
@@ -202,7 +289,7 @@ void rgba5551 (WorkUnit &work)
 				work.result.push_back (v >> 8);
 			}
 
-			if (work.preview)
+			if (preview)
 			{
 				quantumRed (c, quantize<5> (quantumRed (c)));
 				quantumGreen (c, quantize<5> (quantumGreen (c)));
@@ -215,7 +302,8 @@ void rgba5551 (WorkUnit &work)
 	}
 }
 
-void rgb565 (WorkUnit &work)
+template <bool output, bool preview>
+void rgb565_tile (encode::WorkUnit &work)
 {
 	for (size_t j = 0; j < 8; ++j)
 	{
@@ -223,7 +311,7 @@ void rgb565 (WorkUnit &work)
 		{
 			Magick::Color c = work.p[j * work.stride + i];
 
-			if (work.output)
+			if (output)
 			{
 				uint16_t v = (quantum_to_bits<5> (quantumRed (c)) << 11) |
 				             (quantum_to_bits<6> (quantumGreen (c)) << 5) |
@@ -233,7 +321,7 @@ void rgb565 (WorkUnit &work)
 				work.result.push_back (v >> 8);
 			}
 
-			if (work.preview)
+			if (preview)
 			{
 				using Magick::Quantum;
 
@@ -248,7 +336,8 @@ void rgb565 (WorkUnit &work)
 	}
 }
 
-void rgba4444 (WorkUnit &work)
+template <bool output, bool preview>
+void rgba4444_tile (encode::WorkUnit &work)
 {
 	for (size_t j = 0; j < 8; ++j)
 	{
@@ -256,7 +345,7 @@ void rgba4444 (WorkUnit &work)
 		{
 			Magick::Color c = work.p[j * work.stride + i];
 
-			if (work.output)
+			if (output)
 			{
 				uint16_t v = (quantum_to_bits<4> (quantumRed (c)) << 12) |
 				             (quantum_to_bits<4> (quantumGreen (c)) << 8) |
@@ -267,7 +356,7 @@ void rgba4444 (WorkUnit &work)
 				work.result.push_back (v >> 8);
 			}
 
-			if (work.preview)
+			if (preview)
 			{
 				quantumRed (c, quantize<4> (quantumRed (c)));
 				quantumGreen (c, quantize<4> (quantumGreen (c)));
@@ -280,7 +369,8 @@ void rgba4444 (WorkUnit &work)
 	}
 }
 
-void la88 (WorkUnit &work)
+template <bool output, bool preview>
+void la88_tile (encode::WorkUnit &work)
 {
 	for (size_t j = 0; j < 8; ++j)
 	{
@@ -288,13 +378,13 @@ void la88 (WorkUnit &work)
 		{
 			Magick::Color c = work.p[j * work.stride + i];
 
-			if (work.output)
+			if (output)
 			{
 				work.result.push_back (quantum_to_bits<8> (quantumAlpha (c)));
 				work.result.push_back (quantum_to_bits<8> (luminance (c)));
 			}
 
-			if (work.preview)
+			if (preview)
 			{
 				Magick::Quantum l = quantize<8> (luminance (c));
 
@@ -309,7 +399,8 @@ void la88 (WorkUnit &work)
 	}
 }
 
-void hilo88 (WorkUnit &work)
+template <bool output, bool preview>
+void hilo88_tile (encode::WorkUnit &work)
 {
 	for (size_t j = 0; j < 8; ++j)
 	{
@@ -317,13 +408,13 @@ void hilo88 (WorkUnit &work)
 		{
 			Magick::Color c = work.p[j * work.stride + i];
 
-			if (work.output)
+			if (output)
 			{
 				work.result.push_back (quantum_to_bits<8> (quantumGreen (c)));
 				work.result.push_back (quantum_to_bits<8> (quantumRed (c)));
 			}
 
-			if (work.preview)
+			if (preview)
 			{
 				using Magick::Quantum;
 
@@ -338,7 +429,8 @@ void hilo88 (WorkUnit &work)
 	}
 }
 
-void l8 (WorkUnit &work)
+template <bool output, bool preview>
+void l8_tile (encode::WorkUnit &work)
 {
 	for (size_t j = 0; j < 8; ++j)
 	{
@@ -346,10 +438,10 @@ void l8 (WorkUnit &work)
 		{
 			Magick::Color c = work.p[j * work.stride + i];
 
-			if (work.output)
+			if (output)
 				work.result.push_back (quantum_to_bits<8> (luminance (c)));
 
-			if (work.preview)
+			if (preview)
 			{
 				Magick::Quantum l = quantize<8> (luminance (c));
 
@@ -366,7 +458,8 @@ void l8 (WorkUnit &work)
 	}
 }
 
-void a8 (WorkUnit &work)
+template <bool output, bool preview>
+void a8_tile (encode::WorkUnit &work)
 {
 	for (size_t j = 0; j < 8; ++j)
 	{
@@ -374,10 +467,10 @@ void a8 (WorkUnit &work)
 		{
 			Magick::Color c = work.p[j * work.stride + i];
 
-			if (work.output)
+			if (output)
 				work.result.push_back (quantum_to_bits<8> (quantumAlpha (c)));
 
-			if (work.preview)
+			if (preview)
 			{
 				quantumRed (c, 0);
 				quantumGreen (c, 0);
@@ -390,7 +483,8 @@ void a8 (WorkUnit &work)
 	}
 }
 
-void la44 (WorkUnit &work)
+template <bool output, bool preview>
+void la44_tile (encode::WorkUnit &work)
 {
 	for (size_t j = 0; j < 8; ++j)
 	{
@@ -398,13 +492,13 @@ void la44 (WorkUnit &work)
 		{
 			Magick::Color c = work.p[j * work.stride + i];
 
-			if (work.output)
+			if (output)
 			{
 				work.result.push_back ((quantum_to_bits<4> (luminance (c)) << 4) |
 				                       (quantum_to_bits<4> (quantumAlpha (c)) << 0));
 			}
 
-			if (work.preview)
+			if (preview)
 			{
 				Magick::Quantum l = quantize<4> (luminance (c));
 
@@ -419,7 +513,8 @@ void la44 (WorkUnit &work)
 	}
 }
 
-void l4 (WorkUnit &work)
+template <bool output, bool preview>
+void l4_tile (encode::WorkUnit &work)
 {
 	for (size_t j = 0; j < 8; ++j)
 	{
@@ -428,13 +523,13 @@ void l4 (WorkUnit &work)
 			Magick::Color c1 = work.p[j * work.stride + i + 0],
 			              c2 = work.p[j * work.stride + i + 1];
 
-			if (work.output)
+			if (output)
 			{
 				work.result.push_back ((quantum_to_bits<4> (luminance (c2)) << 4) |
 				                       (quantum_to_bits<4> (luminance (c1)) << 0));
 			}
 
-			if (work.preview)
+			if (preview)
 			{
 				Magick::Quantum l = quantize<4> (luminance (c1));
 
@@ -459,7 +554,8 @@ void l4 (WorkUnit &work)
 	}
 }
 
-void a4 (WorkUnit &work)
+template <bool output, bool preview>
+void a4_tile (encode::WorkUnit &work)
 {
 	for (size_t j = 0; j < 8; ++j)
 	{
@@ -468,13 +564,13 @@ void a4 (WorkUnit &work)
 			Magick::Color c1 = work.p[j * work.stride + i + 0],
 			              c2 = work.p[j * work.stride + i + 1];
 
-			if (work.output)
+			if (output)
 			{
 				work.result.push_back ((quantum_to_bits<4> (quantumAlpha (c2)) << 4) |
 				                       (quantum_to_bits<4> (quantumAlpha (c1)) << 0));
 			}
 
-			if (work.preview)
+			if (preview)
 			{
 				quantumRed (c1, 0);
 				quantumGreen (c1, 0);
@@ -493,13 +589,43 @@ void a4 (WorkUnit &work)
 	}
 }
 
-void etc1 (WorkUnit &work)
+template <bool output, bool preview>
+void etc1_tile (encode::WorkUnit &work)
 {
-	etc1_common (work, false);
+	etc1_common<false, output, preview> (work);
 }
 
-void etc1a4 (WorkUnit &work)
+template <bool output, bool preview>
+void etc1a4_tile (encode::WorkUnit &work)
 {
-	etc1_common (work, true);
+	etc1_common<true, output, preview> (work);
 }
 }
+
+/** @brief Define encoder selection for a tile encoder template
+ *  @param name Encoder name
+ */
+#define ENCODER(name)                                                                              \
+	encode::Processor encode::name (bool output, bool preview)                                     \
+	{                                                                                              \
+		static const Processor processors[2][2] = {                                                \
+		    {&name##_tile<false, false>, &name##_tile<false, true>},                               \
+		    {&name##_tile<true, false>, &name##_tile<true, true>},                                 \
+		};                                                                                         \
+		return processors[output][preview];                                                        \
+	}
+
+ENCODER (rgba8888)
+ENCODER (rgb888)
+ENCODER (rgba5551)
+ENCODER (rgb565)
+ENCODER (rgba4444)
+ENCODER (la88)
+ENCODER (hilo88)
+ENCODER (l8)
+ENCODER (a8)
+ENCODER (la44)
+ENCODER (l4)
+ENCODER (a4)
+ENCODER (etc1)
+ENCODER (etc1a4)
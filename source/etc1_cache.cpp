@@ -0,0 +1,400 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file etc1_cache.cpp
+ *  @brief Persistent ETC1 block cache
+ */
+
+#include "etc1_cache.h"
+
+#if defined(HAVE_SYS_FILE_H) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H) &&              \
+    defined(HAVE_FLOCK) && defined(HAVE_MMAP) && defined(HAVE_PREAD)
+/** @brief Whether the cache file can be locked and mapped */
+#define ETC1_CACHE_FILE 1
+#endif
+
+#ifdef ETC1_CACHE_FILE
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+/** @brief Cache file magic */
+#define ETC1_CACHE_MAGIC "T3DSETC1"
+
+/** @brief Cache file version */
+#define ETC1_CACHE_VERSION 1
+
+/** @brief Number of entries per bucket */
+#define ETC1_CACHE_WAYS 4
+
+/** @brief Cache file entry */
+struct ETC1Cache::Entry
+{
+	uint8_t rgb[48];  ///< RGB components of 4x4 block
+	uint8_t block[8]; ///< Packed ETC1 block
+	uint32_t stamp;   ///< Generation of last use
+	uint32_t variant; ///< Encoder variant
+	uint64_t check;   ///< Entry checksum; 0 is an empty entry
+};
+
+/** @brief Cache file header */
+struct ETC1Cache::Header
+{
+	char magic[8];       ///< ETC1_CACHE_MAGIC
+	uint32_t version;    ///< ETC1_CACHE_VERSION
+	uint32_t ways;       ///< ETC1_CACHE_WAYS
+	uint64_t buckets;    ///< Number of buckets
+	uint32_t generation; ///< Merge generation
+	uint8_t reserved[36];
+};
+
+namespace
+{
+/** @brief FNV-1a hash
+ *  @param[in] data Data to hash
+ *  @param[in] size Data size
+ *  @param[in] hash Initial hash
+ *  @returns hash
+ */
+uint64_t fnv1a (const void *data, size_t size, uint64_t hash = 0xCBF29CE484222325ULL)
+{
+	const uint8_t *p = static_cast<const uint8_t *> (data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= p[i];
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+/** @brief Compute entry checksum
+ *  @param[in] rgb     RGB components of 4x4 block
+ *  @param[in] variant Encoder variant
+ *  @param[in] block   Packed ETC1 block
+ *  @returns checksum (never 0)
+ */
+uint64_t checksum (const uint8_t *rgb, uint32_t variant, const uint8_t *block)
+{
+	uint64_t hash = fnv1a (rgb, 48);
+	hash          = fnv1a (&variant, sizeof (variant), hash);
+	hash          = fnv1a (block, 8, hash);
+
+	return hash ? hash : 1;
+}
+}
+
+bool ETC1Cache::Key::operator== (const Key &other) const
+{
+	return variant == other.variant && std::memcmp (rgb, other.rgb, sizeof (rgb)) == 0;
+}
+
+size_t ETC1Cache::KeyHash::operator() (const Key &key) const
+{
+	return fnv1a (&key.variant, sizeof (key.variant), fnv1a (key.rgb, sizeof (key.rgb)));
+}
+
+ETC1Cache::ETC1Cache (const std::string &path, size_t size)
+    : m_path (path), m_fd (-1), m_map (nullptr), m_mapSize (0), m_buckets (0)
+{
+	static_assert (sizeof (Entry) == 72, "Unexpected ETC1 cache entry size");
+	static_assert (sizeof (Header) == 64, "Unexpected ETC1 cache header size");
+
+#ifndef ETC1_CACHE_FILE
+	// blocks are still shared within this run
+	std::fprintf (stderr, "ETC1 cache '%s': not supported on this platform\n", path.c_str ());
+#else
+	m_fd = ::open (path.c_str (), O_RDWR | O_CREAT, 0644);
+	if (m_fd < 0)
+	{
+		std::fprintf (stderr, "ETC1 cache '%s': %s\n", path.c_str (), std::strerror (errno));
+		return;
+	}
+
+	// serialize against other processes creating/merging the cache
+	::flock (m_fd, LOCK_EX);
+
+	// largest bucket count whose table size fits in size_t
+	const uint64_t maxBuckets = (SIZE_MAX - sizeof (Header)) / (ETC1_CACHE_WAYS * sizeof (Entry));
+
+	Header header;
+	struct stat st;
+	if (::fstat (m_fd, &st) != 0 || static_cast<size_t> (st.st_size) < sizeof (header) ||
+	    ::pread (m_fd, &header, sizeof (header), 0) != sizeof (header) ||
+	    std::memcmp (header.magic, ETC1_CACHE_MAGIC, sizeof (header.magic)) != 0 ||
+	    header.version != ETC1_CACHE_VERSION || header.ways != ETC1_CACHE_WAYS ||
+	    header.buckets == 0 || header.buckets > maxBuckets ||
+	    static_cast<uint64_t> (st.st_size) !=
+	        sizeof (header) + header.buckets * ETC1_CACHE_WAYS * sizeof (Entry))
+	{
+		// (re)initialize the cache file
+		std::memset (&header, 0, sizeof (header));
+		std::memcpy (header.magic, ETC1_CACHE_MAGIC, sizeof (header.magic));
+		header.version = ETC1_CACHE_VERSION;
+		header.ways    = ETC1_CACHE_WAYS;
+		header.buckets = std::min<uint64_t> (
+		    maxBuckets, std::max<uint64_t> (1, size / (ETC1_CACHE_WAYS * sizeof (Entry))));
+
+		if (::ftruncate (m_fd, 0) != 0 ||
+		    ::ftruncate (m_fd, sizeof (header) + header.buckets * ETC1_CACHE_WAYS * sizeof (Entry)) !=
+		        0 ||
+		    ::pwrite (m_fd, &header, sizeof (header), 0) != sizeof (header))
+		{
+			std::fprintf (stderr, "ETC1 cache '%s': %s\n", path.c_str (), std::strerror (errno));
+			::flock (m_fd, LOCK_UN);
+			::close (m_fd);
+			m_fd = -1;
+			return;
+		}
+	}
+
+	m_buckets = header.buckets;
+	m_mapSize = sizeof (header) + m_buckets * ETC1_CACHE_WAYS * sizeof (Entry);
+
+	void *map = ::mmap (nullptr, m_mapSize, PROT_READ, MAP_SHARED, m_fd, 0);
+	if (map == MAP_FAILED)
+	{
+		std::fprintf (stderr, "ETC1 cache '%s': %s\n", path.c_str (), std::strerror (errno));
+		::flock (m_fd, LOCK_UN);
+		::close (m_fd);
+		m_fd = -1;
+		return;
+	}
+
+	m_map = static_cast<uint8_t *> (map);
+	::flock (m_fd, LOCK_UN);
+#endif
+}
+
+ETC1Cache::~ETC1Cache ()
+{
+	flush ();
+	unmap ();
+
+#ifdef ETC1_CACHE_FILE
+	if (m_fd >= 0)
+		::close (m_fd);
+#endif
+}
+
+void ETC1Cache::unmap ()
+{
+#ifdef ETC1_CACHE_FILE
+	if (m_map)
+		::munmap (m_map, m_mapSize);
+#endif
+
+	m_map = nullptr;
+}
+
+uint64_t ETC1Cache::hits () const
+{
+	uint64_t hits = 0;
+	for (const auto &shard : m_shards)
+		hits += shard.hits;
+
+	return hits;
+}
+
+uint64_t ETC1Cache::misses () const
+{
+	uint64_t misses = 0;
+	for (const auto &shard : m_shards)
+		misses += shard.misses;
+
+	return misses;
+}
+
+int64_t ETC1Cache::find (const Key &key, size_t hash, uint8_t *block) const
+{
+	const Entry *entries = reinterpret_cast<const Entry *> (m_map + sizeof (Header));
+	const uint64_t bucket = hash % m_buckets;
+
+	for (unsigned way = 0; way < ETC1_CACHE_WAYS; ++way)
+	{
+		const uint64_t slot = bucket * ETC1_CACHE_WAYS + way;
+
+		// copy the entry; another process may be merging into it
+		Entry entry;
+		std::memcpy (&entry, &entries[slot], sizeof (entry));
+
+		if (entry.check == 0 || entry.variant != key.variant ||
+		    std::memcmp (entry.rgb, key.rgb, sizeof (key.rgb)) != 0)
+			continue;
+
+		// reject torn entries
+		if (entry.check != checksum (entry.rgb, entry.variant, entry.block))
+			continue;
+
+		if (block)
+			std::memcpy (block, entry.block, sizeof (entry.block));
+
+		return slot;
+	}
+
+	return -1;
+}
+
+bool ETC1Cache::lookup (const uint8_t *rgba, uint32_t variant, uint8_t *block)
+{
+	Key key;
+	for (unsigned i = 0; i < 16; ++i)
+		std::memcpy (&key.rgb[i * 3], &rgba[i * 4], 3);
+	key.variant = variant;
+
+	const size_t hash = KeyHash () (key);
+
+	// the mapping is read-only and entries are checksummed, so probe it unlocked
+	const int64_t slot = m_map ? find (key, hash, block) : -1;
+
+	Shard &shard = this->shard (hash);
+	std::lock_guard<std::mutex> lock (shard.mutex);
+
+	if (slot >= 0)
+	{
+		// refresh LRU stamp on next flush
+		shard.touched.emplace (slot);
+		++shard.hits;
+		return true;
+	}
+
+	// check entries added during this run
+	auto it = shard.pending.find (key);
+	if (it != std::end (shard.pending))
+	{
+		std::memcpy (block, &it->second, 8);
+		++shard.hits;
+		return true;
+	}
+
+	++shard.misses;
+	return false;
+}
+
+void ETC1Cache::insert (const uint8_t *rgba, uint32_t variant, const uint8_t *block)
+{
+	Key key;
+	for (unsigned i = 0; i < 16; ++i)
+		std::memcpy (&key.rgb[i * 3], &rgba[i * 4], 3);
+	key.variant = variant;
+
+	uint64_t value;
+	std::memcpy (&value, block, 8);
+
+	const size_t hash = KeyHash () (key);
+
+	Shard &shard = this->shard (hash);
+	std::lock_guard<std::mutex> lock (shard.mutex);
+	shard.pending.emplace (key, value);
+}
+
+void ETC1Cache::flush ()
+{
+	if (!m_map)
+		return;
+
+	// collect the shards; keys were already deduplicated within each shard
+	std::vector<std::pair<Key, uint64_t>> pending;
+	std::vector<uint64_t> touched;
+	for (auto &shard : m_shards)
+	{
+		std::lock_guard<std::mutex> lock (shard.mutex);
+
+		pending.insert (std::end (pending), std::begin (shard.pending), std::end (shard.pending));
+		touched.insert (std::end (touched), std::begin (shard.touched), std::end (shard.touched));
+
+		shard.pending.clear ();
+		shard.touched.clear ();
+	}
+
+	if (pending.empty () && touched.empty ())
+		return;
+
+#ifdef ETC1_CACHE_FILE
+	::flock (m_fd, LOCK_EX);
+
+	void *map = ::mmap (nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (map == MAP_FAILED)
+	{
+		std::fprintf (stderr, "ETC1 cache '%s': %s\n", m_path.c_str (), std::strerror (errno));
+		::flock (m_fd, LOCK_UN);
+		return;
+	}
+
+	Header *header = static_cast<Header *> (map);
+	Entry *entries = reinterpret_cast<Entry *> (static_cast<uint8_t *> (map) + sizeof (Header));
+
+	const uint32_t generation = ++header->generation;
+
+	// refresh entries used during this run
+	for (const auto &slot : touched)
+		entries[slot].stamp = generation;
+
+	for (const auto &pair : pending)
+	{
+		const Key &key    = pair.first;
+		const size_t hash = KeyHash () (key);
+
+		// another process may have added this entry since we looked
+		if (find (key, hash, nullptr) >= 0)
+			continue;
+
+		// pick an empty or the least recently used entry in the bucket
+		const uint64_t bucket = hash % m_buckets;
+		Entry *victim         = &entries[bucket * ETC1_CACHE_WAYS];
+		for (unsigned way = 0; way < ETC1_CACHE_WAYS; ++way)
+		{
+			Entry *entry = &entries[bucket * ETC1_CACHE_WAYS + way];
+			if (entry->check == 0)
+			{
+				victim = entry;
+				break;
+			}
+
+			if (entry->stamp < victim->stamp)
+				victim = entry;
+		}
+
+		// invalidate the entry while rewriting it so readers see a miss
+		__atomic_store_n (&victim->check, 0, __ATOMIC_RELEASE);
+
+		std::memcpy (victim->rgb, key.rgb, sizeof (key.rgb));
+		std::memcpy (victim->block, &pair.second, 8);
+		victim->stamp   = generation;
+		victim->variant = key.variant;
+
+		__atomic_store_n (
+		    &victim->check, checksum (victim->rgb, victim->variant, victim->block), __ATOMIC_RELEASE);
+	}
+
+	::munmap (map, m_mapSize);
+	::flock (m_fd, LOCK_UN);
+#endif
+}
@@ -0,0 +1,236 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file etc1_fast.cpp
+ *  @brief Fast ETC1 block packer
+ */
+
+#include "etc1_fast.h"
+
+#include <climits>
+#include <cstring>
+
+namespace
+{
+/** @brief ETC1 intensity modifier tables, indexed by selector */
+const int inten_tables[8][4] = {
+    /* clang-format off */
+	{  2,   8,  -2,   -8, },
+	{  5,  17,  -5,  -17, },
+	{  9,  29,  -9,  -29, },
+	{ 13,  42, -13,  -42, },
+	{ 18,  60, -18,  -60, },
+	{ 24,  80, -24,  -80, },
+	{ 33, 106, -33, -106, },
+	{ 47, 183, -47, -183, },
+    /* clang-format on */
+};
+
+/** @brief Pixel indices of each subblock, indexed by flip */
+const uint8_t subblock_pixels[2][2][8] = {
+    /* clang-format off */
+	{ { 0, 1, 4, 5,  8,  9, 12, 13, }, { 2,  3,  6,  7, 10, 11, 14, 15, }, }, // left/right
+	{ { 0, 1, 2, 3,  4,  5,  6,  7, }, { 8,  9, 10, 11, 12, 13, 14, 15, }, }, // top/bottom
+    /* clang-format on */
+};
+
+/** @brief Clamp to 8-bit component
+ *  @param[in] value Value to clamp
+ *  @returns clamped value
+ */
+inline int clamp8 (int value)
+{
+	return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/** @brief Choose intensity table and selectors for a subblock
+ *  @param[in]  rgba      4x4 RGBA input block
+ *  @param[in]  pixels    Subblock pixel indices
+ *  @param[in]  base      Subblock base color
+ *  @param[out] table     Intensity table
+ *  @param[out] selectors Selector for each subblock pixel
+ *  @returns squared error of subblock
+ */
+unsigned encode_subblock (const uint8_t *rgba,
+    const uint8_t *pixels,
+    const int *base,
+    unsigned &table,
+    uint8_t *selectors)
+{
+	// project each pixel onto the luma axis relative to the base color
+	int delta[8];
+	for (unsigned i = 0; i < 8; ++i)
+	{
+		const uint8_t *c = &rgba[pixels[i] * 4];
+		delta[i]         = (c[0] - base[0]) + (c[1] - base[1]) + (c[2] - base[2]);
+	}
+
+	// pick the table whose modifiers best fit the projections
+	unsigned best_error = UINT_MAX;
+	table               = 0;
+	for (unsigned t = 0; t < 8; ++t)
+	{
+		unsigned error = 0;
+		for (unsigned i = 0; i < 8; ++i)
+		{
+			unsigned best = UINT_MAX;
+			for (unsigned s = 0; s < 4; ++s)
+			{
+				const int d      = delta[i] - 3 * inten_tables[t][s];
+				const unsigned e = d * d;
+				best             = e < best ? e : best;
+			}
+
+			error += best;
+		}
+
+		if (error < best_error)
+		{
+			best_error = error;
+			table      = t;
+		}
+	}
+
+	// choose selectors against the clamped colors
+	unsigned error = 0;
+	for (unsigned i = 0; i < 8; ++i)
+	{
+		const uint8_t *c = &rgba[pixels[i] * 4];
+
+		unsigned best = UINT_MAX;
+		for (unsigned s = 0; s < 4; ++s)
+		{
+			const int m      = inten_tables[table][s];
+			const int dr     = clamp8 (base[0] + m) - c[0];
+			const int dg     = clamp8 (base[1] + m) - c[1];
+			const int db     = clamp8 (base[2] + m) - c[2];
+			const unsigned e = dr * dr + dg * dg + db * db;
+			if (e < best)
+			{
+				best         = e;
+				selectors[i] = s;
+			}
+		}
+
+		error += best;
+	}
+
+	return error;
+}
+
+/** @brief Pack ETC1 block with a given flip orientation
+ *  @param[out] block Packed ETC1 block
+ *  @param[in]  rgba  4x4 RGBA input block
+ *  @param[in]  flip  Flip orientation
+ *  @returns squared error of result
+ */
+unsigned encode_flip (uint8_t *block, const uint8_t *rgba, unsigned flip)
+{
+	// average color of each subblock
+	int avg[2][3];
+	for (unsigned sb = 0; sb < 2; ++sb)
+	{
+		for (unsigned ch = 0; ch < 3; ++ch)
+		{
+			int sum = 0;
+			for (unsigned i = 0; i < 8; ++i)
+				sum += rgba[subblock_pixels[flip][sb][i] * 4 + ch];
+
+			avg[sb][ch] = (sum + 4) / 8;
+		}
+	}
+
+	// use differential mode if the 5-bit averages are close enough
+	int q5[2][3];
+	bool diff = true;
+	for (unsigned ch = 0; ch < 3; ++ch)
+	{
+		q5[0][ch]   = (avg[0][ch] * 31 + 127) / 255;
+		q5[1][ch]   = (avg[1][ch] * 31 + 127) / 255;
+		const int d = q5[1][ch] - q5[0][ch];
+		if (d < -4 || d > 3)
+			diff = false;
+	}
+
+	int base[2][3];
+	for (unsigned ch = 0; ch < 3; ++ch)
+	{
+		if (diff)
+		{
+			base[0][ch] = (q5[0][ch] << 3) | (q5[0][ch] >> 2);
+			base[1][ch] = (q5[1][ch] << 3) | (q5[1][ch] >> 2);
+			block[ch]   = (q5[0][ch] << 3) | ((q5[1][ch] - q5[0][ch]) & 0x7);
+		}
+		else
+		{
+			const int q4a = (avg[0][ch] * 15 + 127) / 255;
+			const int q4b = (avg[1][ch] * 15 + 127) / 255;
+			base[0][ch]   = (q4a << 4) | q4a;
+			base[1][ch]   = (q4b << 4) | q4b;
+			block[ch]     = (q4a << 4) | q4b;
+		}
+	}
+
+	unsigned table[2];
+	uint8_t selectors[2][8];
+	unsigned error = 0;
+	for (unsigned sb = 0; sb < 2; ++sb)
+		error += encode_subblock (rgba, subblock_pixels[flip][sb], base[sb], table[sb], selectors[sb]);
+
+	block[3] = (table[0] << 5) | (table[1] << 2) | (diff << 1) | flip;
+
+	// selector bits are stored column-major; MSBs in the upper half
+	uint32_t bits = 0;
+	for (unsigned sb = 0; sb < 2; ++sb)
+	{
+		for (unsigned i = 0; i < 8; ++i)
+		{
+			const unsigned p   = subblock_pixels[flip][sb][i];
+			const unsigned bit = (p % 4) * 4 + p / 4;
+			const unsigned s   = selectors[sb][i];
+
+			bits |= (s & 1u) << bit;
+			bits |= (s >> 1) << (bit + 16);
+		}
+	}
+
+	block[4] = bits >> 24;
+	block[5] = bits >> 16;
+	block[6] = bits >> 8;
+	block[7] = bits >> 0;
+
+	return error;
+}
+}
+
+unsigned etc1_fast::pack_etc1_block (uint8_t *block, const uint8_t *rgba)
+{
+	uint8_t flipped[8];
+
+	const unsigned error         = encode_flip (block, rgba, 0);
+	const unsigned flipped_error = encode_flip (flipped, rgba, 1);
+
+	if (flipped_error < error)
+	{
+		std::memcpy (block, flipped, sizeof (flipped));
+		return flipped_error;
+	}
+
+	return error;
+}
@@ -23,6 +23,7 @@
  */
 
 #include "freetype.h"
+#include "stats.h"
 using namespace freetype;
 
 ///////////////////////////////////////////////////////////////////////////
@@ -100,6 +101,8 @@ FT_Face Face::getFace ()
 	if (face)
 		return face;
 
+	const auto start = stats::Clock::now ();
+
 	FT_Error error;
 	{
 		auto libraryLock = m_library->lock ();
@@ -128,6 +131,13 @@ FT_Face Face::getFace ()
 		return nullptr;
 	}
 
+	// each thread opens its own face; sum the time over all of them
+	if (stats::enabled)
+	{
+		stats::addTime ("face load (all threads)", stats::Clock::now () - start);
+		stats::addCount ("faces loaded", 1);
+	}
+
 	return face;
 }
 
@@ -0,0 +1,477 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file input_cache.cpp
+ *  @brief Decoded input cache
+ */
+
+#include "input_cache.h"
+
+#if defined(HAVE_FCNTL_H) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H) &&               \
+    defined(HAVE_MMAP) && defined(HAVE_PWRITE)
+/** @brief Whether cache files can be mapped */
+#define INPUT_CACHE_FILE 1
+#endif
+
+#ifdef INPUT_CACHE_FILE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <utility>
+
+/** @brief Cache file magic */
+#define INPUT_CACHE_MAGIC "T3DSRGBA"
+
+/** @brief Cache file version */
+#define INPUT_CACHE_VERSION 2
+
+namespace
+{
+#ifdef INPUT_CACHE_FILE
+/** @brief Cache file header
+ *
+ *  @details
+ *  The header is followed by the source path (padded to 8 bytes), the width
+ *  and height of each frame as two uint32_t, and then each frame's RGBA
+ *  pixels (8 bits per component).
+ */
+struct Header
+{
+	char magic[8];      ///< INPUT_CACHE_MAGIC
+	uint32_t version;   ///< INPUT_CACHE_VERSION
+	uint32_t frames;    ///< Number of frames
+	uint64_t size;      ///< Source file size
+	int64_t mtime_sec;  ///< Source modification time (seconds)
+	int64_t mtime_nsec; ///< Source modification time (nanoseconds)
+	uint64_t hash;      ///< Source content hash
+	uint32_t path_len;  ///< Source path length
+	uint32_t reserved;  ///< Reserved
+};
+#endif
+
+/** @brief Cached input */
+struct Entry
+{
+	struct timespec mtime;             ///< Modification time when decoded
+	off_t size;                        ///< File size when decoded
+	std::vector<Magick::Image> images; ///< Decoded images
+};
+
+/** @brief Formats whose images are animation frames */
+const char *const animation_formats[] = {"APNG", "GIF", "GIF87", "MNG", "WEBP"};
+
+/** @brief Cached inputs, keyed by path and whether all frames were loaded */
+std::map<std::pair<std::string, bool>, Entry> entries;
+
+/** @brief Cache mutex */
+std::mutex cache_mutex;
+
+/** @brief Whether decoded inputs are kept */
+std::atomic<bool> retain (false);
+
+/** @brief Cache directory; empty for no on-disk cache */
+std::string cache_dir;
+
+/** @brief Get modification time
+ *  @param[in] st File status
+ *  @returns modification time; whole seconds where the platform has no finer time
+ */
+struct timespec modTime (const struct stat &st)
+{
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+	return st.st_mtim;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+	return st.st_mtimespec;
+#else
+	struct timespec mtime;
+	mtime.tv_sec  = st.st_mtime;
+	mtime.tv_nsec = 0;
+	return mtime;
+#endif
+}
+
+#ifdef INPUT_CACHE_FILE
+/** @brief FNV-1a hash
+ *  @param[in] data Data to hash
+ *  @param[in] size Data size
+ *  @param[in] hash Initial hash
+ *  @returns hash
+ */
+uint64_t fnv1a (const void *data, size_t size, uint64_t hash = 0xCBF29CE484222325ULL)
+{
+	const uint8_t *p = static_cast<const uint8_t *> (data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= p[i];
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+/** @brief Hash file contents
+ *  @param[in]  path Path to hash
+ *  @param[out] hash Content hash
+ *  @returns whether successful
+ */
+bool hashFile (const std::string &path, uint64_t &hash)
+{
+	FILE *fp = std::fopen (path.c_str (), "rb");
+	if (!fp)
+		return false;
+
+	hash = fnv1a (nullptr, 0);
+
+	char buffer[65536];
+	size_t rc;
+	while ((rc = std::fread (buffer, 1, sizeof (buffer), fp)) > 0)
+		hash = fnv1a (buffer, rc, hash);
+
+	const bool failed = std::ferror (fp);
+	std::fclose (fp);
+	return !failed;
+}
+
+/** @brief Get the cache file for an input
+ *  @param[in] path   Input path
+ *  @param[in] frames Whether every frame is loaded
+ *  @returns cache file path
+ */
+std::string cacheFile (const std::string &path, bool frames)
+{
+	char name[32];
+	std::snprintf (name, sizeof (name), "%016llx%s.rgba",
+	    static_cast<unsigned long long> (fnv1a (path.data (), path.size ())),
+	    frames ? "-frames" : "");
+
+	return cache_dir + '/' + name;
+}
+
+/** @brief Round up to a multiple of 8
+ *  @param[in] x Value to round
+ *  @returns rounded value
+ */
+inline size_t align8 (size_t x)
+{
+	return (x + 7) & ~static_cast<size_t> (7);
+}
+
+/** @brief Read input from the on-disk cache
+ *  @param[in]  path   Input path
+ *  @param[in]  frames Whether every frame is loaded
+ *  @param[in]  st     Input file status
+ *  @param[out] images Decoded images
+ *  @param[out] hash   Input content hash; computed if the cache cannot be used by mtime
+ *  @returns whether successful
+ */
+bool readCache (const std::string &path,
+    bool frames,
+    const struct stat &st,
+    std::vector<Magick::Image> &images,
+    uint64_t &hash)
+{
+	hash = 0;
+
+	const std::string file = cacheFile (path, frames);
+	const int fd           = ::open (file.c_str (), O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct stat cst;
+	if (::fstat (fd, &cst) != 0 || static_cast<size_t> (cst.st_size) < sizeof (Header))
+	{
+		::close (fd);
+		return false;
+	}
+
+	const size_t map_size = cst.st_size;
+	void *map             = ::mmap (nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		::close (fd);
+		return false;
+	}
+
+	const uint8_t *base = static_cast<const uint8_t *> (map);
+	Header header;
+	std::memcpy (&header, base, sizeof (header));
+
+	// validate the header and the recorded path
+	size_t offset = sizeof (header) + align8 (header.path_len);
+	bool valid    = std::memcmp (header.magic, INPUT_CACHE_MAGIC, sizeof (header.magic)) == 0 &&
+	             header.version == INPUT_CACHE_VERSION && header.frames > 0 &&
+	             header.path_len == path.size () && offset + header.frames * 8ull <= map_size &&
+	             std::memcmp (base + sizeof (header), path.data (), path.size ()) == 0 &&
+	             header.size == static_cast<uint64_t> (st.st_size);
+
+	std::vector<std::pair<uint32_t, uint32_t>> dims (valid ? header.frames : 0);
+	size_t pixels = offset + header.frames * 8ull;
+	for (size_t i = 0; i < dims.size (); ++i)
+	{
+		std::memcpy (&dims[i].first, base + offset + i * 8, 4);
+		std::memcpy (&dims[i].second, base + offset + i * 8 + 4, 4);
+		pixels += static_cast<uint64_t> (dims[i].first) * dims[i].second * 4;
+	}
+	valid = valid && pixels == map_size;
+
+	// a changed mtime alone does not invalidate the entry if the contents are the same
+	const struct timespec mtime = modTime (st);
+	const bool fresh = header.mtime_sec == mtime.tv_sec && header.mtime_nsec == mtime.tv_nsec;
+	if (valid && !fresh)
+	{
+		if (!hashFile (path, hash) || hash != header.hash)
+			valid = false;
+		else
+		{
+			// record the new mtime so the next lookup does not hash again
+			header.mtime_sec  = mtime.tv_sec;
+			header.mtime_nsec = mtime.tv_nsec;
+			if (::pwrite (fd, &header, sizeof (header), 0) != sizeof (header))
+			{
+				std::fprintf (
+				    stderr, "input cache '%s': %s\n", file.c_str (), std::strerror (errno));
+			}
+		}
+	}
+
+	if (valid)
+	{
+		const uint8_t *p = base + offset + header.frames * 8ull;
+		for (const auto &dim : dims)
+		{
+			images.emplace_back (dim.first, dim.second, "RGBA", Magick::CharPixel, p);
+			images.back ().fileName (path);
+			p += static_cast<size_t> (dim.first) * dim.second * 4;
+		}
+	}
+
+	::munmap (map, map_size);
+	::close (fd);
+	return valid;
+}
+
+/** @brief Write input to the on-disk cache
+ *  @param[in] path   Input path
+ *  @param[in] frames Whether every frame is loaded
+ *  @param[in] st     Input file status
+ *  @param[in] images Decoded images
+ *  @param[in] hash   Input content hash; 0 if not computed yet
+ *  @returns images rebuilt from the stored RGBA pixels, as readCache would give them
+ */
+std::vector<Magick::Image> writeCache (const std::string &path,
+    bool frames,
+    const struct stat &st,
+    const std::vector<Magick::Image> &images,
+    uint64_t hash)
+{
+	Header header;
+	std::memset (&header, 0, sizeof (header));
+	std::memcpy (header.magic, INPUT_CACHE_MAGIC, sizeof (header.magic));
+	header.version    = INPUT_CACHE_VERSION;
+	header.frames     = images.size ();
+	header.size       = st.st_size;
+	header.mtime_sec  = modTime (st).tv_sec;
+	header.mtime_nsec = modTime (st).tv_nsec;
+	header.path_len   = path.size ();
+
+	std::vector<uint8_t> data (sizeof (header) + align8 (path.size ()) + images.size () * 8);
+	std::memcpy (&data[0], &header, sizeof (header));
+	std::memcpy (&data[sizeof (header)], path.data (), path.size ());
+
+	uint8_t *dims = &data[sizeof (header) + align8 (path.size ())];
+	for (const auto &img : images)
+	{
+		const uint32_t width  = img.columns ();
+		const uint32_t height = img.rows ();
+		std::memcpy (dims, &width, 4);
+		std::memcpy (dims + 4, &height, 4);
+		dims += 8;
+	}
+
+	std::vector<size_t> offsets;
+	for (const auto &img : images)
+	{
+		offsets.emplace_back (data.size ());
+		data.resize (offsets.back () + img.columns () * img.rows () * 4);
+		img.write (
+		    0, 0, img.columns (), img.rows (), "RGBA", Magick::CharPixel, &data[offsets.back ()]);
+	}
+
+	// a hit gives 8-bit pixels, so a miss must give the same
+	std::vector<Magick::Image> stored;
+	for (size_t i = 0; i < images.size (); ++i)
+	{
+		stored.emplace_back (
+		    images[i].columns (), images[i].rows (), "RGBA", Magick::CharPixel, &data[offsets[i]]);
+		stored.back ().fileName (path);
+	}
+
+	if (!hash && !hashFile (path, hash))
+		return stored;
+
+	header.hash = hash;
+	std::memcpy (&data[0], &header, sizeof (header));
+
+	// write to a temporary file and rename so readers never see a partial entry
+	const std::string file = cacheFile (path, frames);
+	const std::string tmp  = file + '.' + std::to_string (::getpid ());
+
+	FILE *fp = std::fopen (tmp.c_str (), "wb");
+	if (!fp)
+	{
+		std::fprintf (stderr, "input cache '%s': %s\n", tmp.c_str (), std::strerror (errno));
+		return stored;
+	}
+
+	const bool written = std::fwrite (data.data (), 1, data.size (), fp) == data.size ();
+	if (std::fclose (fp) != 0 || !written || std::rename (tmp.c_str (), file.c_str ()) != 0)
+	{
+		std::fprintf (stderr, "input cache '%s': %s\n", file.c_str (), std::strerror (errno));
+		std::remove (tmp.c_str ());
+	}
+
+	return stored;
+}
+#endif
+
+/** @brief Decode input
+ *  @param[in] path   Input path
+ *  @param[in] frames Whether to load every frame
+ *  @returns decoded images
+ */
+std::vector<Magick::Image> decode (const std::string &path, bool frames)
+{
+	std::vector<Magick::Image> images;
+	if (!frames)
+	{
+		images.emplace_back (path);
+		return images;
+	}
+
+	std::vector<Magick::Image> raw;
+	Magick::readImages (&raw, path);
+
+	// layers, icon sizes and pages are not frames; keep the first image, as Magick::Image (path)
+	const std::string format = raw.front ().magick ();
+	if (std::none_of (std::begin (animation_formats),
+	        std::end (animation_formats),
+	        [&](const char *animation) { return format == animation; }))
+		raw.erase (std::next (std::begin (raw)), std::end (raw));
+
+	if (raw.size () == 1)
+		return raw;
+
+	// animation frames may only hold the changed region
+	Magick::coalesceImages (&images, std::begin (raw), std::end (raw));
+	return images;
+}
+
+/** @brief Load input
+ *  @param[in] path   Input path
+ *  @param[in] frames Whether to load every frame
+ *  @returns decoded images
+ */
+std::vector<Magick::Image> load (const std::string &path, bool frames)
+{
+	struct stat st;
+	if ((!retain && cache_dir.empty ()) || ::stat (path.c_str (), &st) != 0)
+		return decode (path, frames);
+
+	const auto key = std::make_pair (path, frames);
+	if (retain)
+	{
+		std::lock_guard<std::mutex> lock (cache_mutex);
+		auto it = entries.find (key);
+		const struct timespec mtime = modTime (st);
+		if (it != std::end (entries) && it->second.size == st.st_size &&
+		    it->second.mtime.tv_sec == mtime.tv_sec && it->second.mtime.tv_nsec == mtime.tv_nsec)
+			return it->second.images;
+	}
+
+	// decode outside the lock; images share pixels until modified
+	std::vector<Magick::Image> images;
+#ifdef INPUT_CACHE_FILE
+	uint64_t hash = 0;
+	if (!cache_dir.empty () && !readCache (path, frames, st, images, hash))
+		images = writeCache (path, frames, st, decode (path, frames), hash);
+#endif
+	if (images.empty ())
+		images = decode (path, frames);
+
+	if (retain)
+	{
+		std::lock_guard<std::mutex> lock (cache_mutex);
+		entries[key] = Entry{modTime (st), st.st_size, images};
+	}
+
+	return images;
+}
+}
+
+void input_cache::setRetain (bool enable)
+{
+	retain = enable;
+	if (!enable)
+	{
+		std::lock_guard<std::mutex> lock (cache_mutex);
+		entries.clear ();
+	}
+}
+
+bool input_cache::setDirectory (const std::string &dir)
+{
+#ifndef INPUT_CACHE_FILE
+	if (!dir.empty ())
+	{
+		std::fprintf (stderr, "input cache '%s': not supported on this platform\n", dir.c_str ());
+		return false;
+	}
+#else
+	if (!dir.empty () && ::mkdir (dir.c_str (), 0755) != 0 && errno != EEXIST)
+	{
+		std::fprintf (stderr, "input cache '%s': %s\n", dir.c_str (), std::strerror (errno));
+		return false;
+	}
+#endif
+
+	cache_dir = dir;
+	return true;
+}
+
+Magick::Image input_cache::image (const std::string &path)
+{
+	return load (path, false).front ();
+}
+
+std::vector<Magick::Image> input_cache::frames (const std::string &path)
+{
+	return load (path, true);
+}
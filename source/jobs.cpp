@@ -0,0 +1,406 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file jobs.cpp
+ *  @brief Thread budget
+ */
+
+#include "magick_compat.h"
+
+#include "jobs.h"
+
+#if defined(HAVE_FCNTL_H) && defined(HAVE_UNISTD_H) && defined(HAVE_FCNTL)
+/** @brief Whether jobserver pipes can be used */
+#define JOBSERVER_PIPES 1
+#endif
+
+#if defined(JOBSERVER_PIPES) && defined(__linux__)
+/** @brief Whether an inherited pipe can be reopened through /proc to make reads non-blocking */
+#define JOBSERVER_REOPEN 1
+#endif
+
+#ifdef JOBSERVER_PIPES
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace
+{
+/** @brief Thread budget; 0 until set */
+std::atomic<unsigned> budget (0);
+
+/** @brief Number of active SerialMagick scopes */
+unsigned serial = 0;
+
+/** @brief SerialMagick mutex */
+std::mutex serial_mutex;
+
+/** @brief GNU make jobserver state */
+enum JobServerState
+{
+	JOBSERVER_NONE,        ///< Not run from a parallel make
+	JOBSERVER_ACTIVE,      ///< Tokens are read from the jobserver
+	JOBSERVER_UNAVAILABLE, ///< Advertised, but its descriptors were not passed to us
+};
+
+/** @brief GNU make jobserver */
+struct JobServer
+{
+	JobServerState state; ///< Jobserver state
+	int readFd;           ///< Non-blocking read descriptor
+	int writeFd;          ///< Write descriptor
+};
+
+/** @brief Connect to the GNU make jobserver advertised in MAKEFLAGS
+ *  @returns jobserver
+ */
+JobServer openJobServer ()
+{
+	JobServer server{JOBSERVER_NONE, -1, -1};
+
+	const char *flags = std::getenv ("MAKEFLAGS");
+	if (!flags)
+		return server;
+
+	// the last occurrence wins; make before 4.2 spells it --jobserver-fds
+	std::string auth;
+	std::istringstream stream (flags);
+	std::string word;
+	while (stream >> word && word != "--")
+	{
+		for (const char *prefix : {"--jobserver-auth=", "--jobserver-fds="})
+		{
+			const size_t length = std::strlen (prefix);
+			if (word.compare (0, length, prefix) == 0)
+				auth = word.substr (length);
+		}
+	}
+
+	if (auth.empty ())
+		return server;
+
+	server.state = JOBSERVER_UNAVAILABLE;
+#ifdef JOBSERVER_PIPES
+	if (auth.compare (0, 5, "fifo:") == 0)
+	{
+		// make 4.4 and later use a named pipe
+		const std::string path = auth.substr (5);
+
+		server.readFd = ::open (path.c_str (), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (server.readFd < 0)
+			return server;
+
+		server.writeFd = ::open (path.c_str (), O_WRONLY | O_CLOEXEC);
+		if (server.writeFd < 0)
+		{
+			::close (server.readFd);
+			server.readFd = -1;
+			return server;
+		}
+	}
+	else
+	{
+		// make only passes the pipe to recipes marked with '+'
+		int readFd, writeFd;
+		char extra;
+		if (std::sscanf (auth.c_str (), "%d,%d%c", &readFd, &writeFd, &extra) != 2 ||
+		    ::fcntl (readFd, F_GETFD) < 0 || ::fcntl (writeFd, F_GETFD) < 0)
+			return server;
+
+#ifdef JOBSERVER_REOPEN
+		// reopen the read end so it can be non-blocking without affecting make
+		char path[32];
+		std::snprintf (path, sizeof (path), "/proc/self/fd/%d", readFd);
+		server.readFd = ::open (path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (server.readFd < 0)
+			return server;
+
+		server.writeFd = writeFd;
+#else
+		// elsewhere /dev/fd shares make's file description, so reads could not be non-blocking
+		return server;
+#endif
+	}
+
+	server.state = JOBSERVER_ACTIVE;
+#endif
+	return server;
+}
+
+/** @brief Get the GNU make jobserver
+ *  @returns jobserver
+ */
+JobServer &jobServer ()
+{
+	static JobServer server = openJobServer ();
+	return server;
+}
+
+/** @brief Set ImageMagick thread limit
+ *  @param[in] count Number of threads
+ */
+void setMagickThreads (unsigned count)
+{
+#if MagickLibVersion >= 0x700
+	Magick::ResourceLimits::thread (count);
+#else
+	MagickCore::SetMagickResourceLimit (MagickCore::ThreadResource, count);
+#endif
+}
+
+/** @brief Get ImageMagick's thread limit outside of SerialMagick scopes
+ *  @returns number of threads
+ */
+unsigned magickThreads ()
+{
+	// ImageMagick's OpenMP threads cannot take job tokens from make
+	if (budget == 0 && jobServer ().state != JOBSERVER_NONE)
+		return 1;
+
+	return jobs::count ();
+}
+}
+
+unsigned jobs::count ()
+{
+	const unsigned count = budget;
+	if (count)
+		return count;
+
+	return std::max (1u, std::thread::hardware_concurrency ());
+}
+
+void jobs::setCount (unsigned count)
+{
+	budget = count;
+	setMagickThreads (magickThreads ());
+}
+
+void jobs::setMemoryLimit (size_t mib)
+{
+	const MagickCore::MagickSizeType bytes = static_cast<MagickCore::MagickSizeType> (mib) << 20;
+
+#if MagickLibVersion >= 0x700
+	Magick::ResourceLimits::memory (bytes);
+	Magick::ResourceLimits::map (bytes);
+#else
+	MagickCore::SetMagickResourceLimit (MagickCore::MemoryResource, bytes);
+	MagickCore::SetMagickResourceLimit (MagickCore::MapResource, bytes);
+#endif
+}
+
+bool jobs::serveTokens ()
+{
+	JobServer &server = jobServer ();
+	if (server.state != JOBSERVER_NONE)
+		return server.state == JOBSERVER_ACTIVE;
+
+#ifndef JOBSERVER_REOPEN
+	// children could not read the pipe without blocking; each uses its own thread budget
+	return false;
+#else
+	// children inherit the pipe, so it must not be close-on-exec
+	int fds[2];
+	if (::pipe (fds) != 0)
+	{
+		std::fprintf (stderr, "pipe: %s\n", std::strerror (errno));
+		return false;
+	}
+
+	// the first thread of every process runs without a token
+	const std::string tokens (count () - 1, '+');
+	if (!tokens.empty () && ::write (fds[1], tokens.data (), tokens.size ()) !=
+	                            static_cast<ssize_t> (tokens.size ()))
+	{
+		std::fprintf (stderr, "jobserver: %s\n", std::strerror (errno));
+		::close (fds[0]);
+		::close (fds[1]);
+		return false;
+	}
+
+	// our own reads are non-blocking; children reopen the read end themselves
+	char path[32];
+	std::snprintf (path, sizeof (path), "/proc/self/fd/%d", fds[0]);
+	const int readFd = ::open (path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (readFd < 0)
+	{
+		std::fprintf (stderr, "open '%s': %s\n", path, std::strerror (errno));
+		::close (fds[0]);
+		::close (fds[1]);
+		return false;
+	}
+
+	std::string flags;
+	if (const char *old = std::getenv ("MAKEFLAGS"))
+		flags = old;
+
+	flags += " -j" + std::to_string (count ()) + " --jobserver-auth=" + std::to_string (fds[0]) +
+	         "," + std::to_string (fds[1]);
+	::setenv ("MAKEFLAGS", flags.c_str (), 1);
+
+	server = JobServer{JOBSERVER_ACTIVE, readFd, fds[1]};
+	return true;
+#endif
+}
+
+bool jobs::parseCount (const char *str, unsigned &count)
+{
+	char *end;
+	errno               = 0;
+	unsigned long value = std::strtoul (str, &end, 10);
+	if (errno || *end || end == str || value == 0 || value > 1024)
+		return false;
+
+	count = value;
+	return true;
+}
+
+bool jobs::parseMemoryLimit (const char *str, size_t &mib)
+{
+	char *end;
+	errno               = 0;
+	unsigned long value = std::strtoul (str, &end, 10);
+	if (errno || *end || end == str || value == 0)
+		return false;
+
+	mib = value;
+	return true;
+}
+
+jobs::Token::Token () : m_value (0), m_held (false)
+{
+}
+
+jobs::Token::~Token ()
+{
+	release ();
+}
+
+jobs::Token::Token (Token &&other) : m_value (other.m_value), m_held (other.m_held)
+{
+	other.m_held = false;
+}
+
+jobs::Token &jobs::Token::operator= (Token &&other)
+{
+	if (this != &other)
+	{
+		release ();
+		m_value      = other.m_value;
+		m_held       = other.m_held;
+		other.m_held = false;
+	}
+
+	return *this;
+}
+
+bool jobs::Token::acquire ()
+{
+	if (m_held)
+		return true;
+
+	const JobServer &server = jobServer ();
+	switch (server.state)
+	{
+	case JOBSERVER_NONE:
+		m_held = true;
+		break;
+
+	case JOBSERVER_UNAVAILABLE:
+		// like a sub-make, fall back to a single thread unless -j was given
+		m_held = budget != 0;
+		break;
+
+	case JOBSERVER_ACTIVE:
+	{
+#ifdef JOBSERVER_PIPES
+		ssize_t rc;
+		do
+			rc = ::read (server.readFd, &m_value, 1);
+		while (rc < 0 && errno == EINTR);
+
+		m_held = rc == 1;
+#endif
+		break;
+	}
+	}
+
+	return m_held;
+}
+
+void jobs::Token::release ()
+{
+	if (!m_held)
+		return;
+
+	m_held = false;
+
+#ifdef JOBSERVER_PIPES
+	const JobServer &server = jobServer ();
+	if (server.state != JOBSERVER_ACTIVE)
+		return;
+
+	// give back the same byte; make uses it to tell tokens apart
+	ssize_t rc;
+	do
+		rc = ::write (server.writeFd, &m_value, 1);
+	while (rc < 0 && errno == EINTR);
+
+	if (rc != 1)
+		std::fprintf (stderr, "jobserver: failed to return token: %s\n", std::strerror (errno));
+#endif
+}
+
+jobs::Reservation::Reservation (size_t want)
+{
+	want = std::min<size_t> (want, count ());
+	while (tokens.size () + 1 < want)
+	{
+		Token token;
+		if (!token.acquire ())
+			break;
+
+		tokens.emplace_back (std::move (token));
+	}
+}
+
+jobs::SerialMagick::SerialMagick ()
+{
+	std::lock_guard<std::mutex> lock (serial_mutex);
+	if (serial++ == 0)
+		setMagickThreads (1);
+}
+
+jobs::SerialMagick::~SerialMagick ()
+{
+	std::lock_guard<std::mutex> lock (serial_mutex);
+	if (--serial == 0)
+		setMagickThreads (magickThreads ());
+}
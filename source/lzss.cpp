@@ -22,8 +22,12 @@
  */
 
 #include "compress.h"
+#include "jobs.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <thread>
 #include <vector>
 
 /** @brief LZSS/LZ10 maximum match length */
@@ -38,6 +42,9 @@
 /** @brief LZ11 maximum displacement */
 #define LZ11_MAX_DISP 4096
 
+/** @brief Parallel LZ chunk size */
+#define LZ_PARALLEL_CHUNK 0x10000
+
 namespace
 {
 /** @brief LZ compression mode */
@@ -124,14 +131,25 @@ const uint8_t *find_best_match (const uint8_t *start,
 	return nullptr;
 }
 
-/** @brief LZSS/LZ10/LZ11 compression
- *  @param[in]  buffer Source buffer
- *  @param[in]  len    Source length
- *  @param[out] outlen Output length
+/** @brief LZ token */
+struct Token
+{
+	uint32_t len;  ///< Match length; 1 is a copied byte
+	uint32_t disp; ///< Match displacement
+};
+
+/** @brief Tokenize LZSS/LZ10/LZ11 input
+ *  @param[in]  start  Start of input buffer (matches never reach before this)
+ *  @param[in]  buffer First byte to tokenize
+ *  @param[in]  len    Number of bytes to tokenize (matches never cross this)
  *  @param[in]  mode   LZ mode
- *  @returns Compressed buffer
+ *  @param[out] tokens Output tokens
  */
-std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t mode)
+void lzssTokenize (const uint8_t *start,
+    const uint8_t *buffer,
+    size_t len,
+    LZSS_t mode,
+    std::vector<Token> &tokens)
 {
 	// get maximum match length
 	const size_t max_len = mode == LZ10 ? LZ10_MAX_LEN : LZ11_MAX_LEN;
@@ -141,24 +159,7 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 
 	assert (mode == LZ10 || mode == LZ11);
 
-	// create output buffer
-	std::vector<uint8_t> result;
-
-	// append compression header
-	if (mode == LZ10)
-		compressionHeader (result, 0x10, len);
-	else
-		compressionHeader (result, 0x11, len);
-
-	// reserve an encode byte in output buffer
-	size_t code_pos = result.size ();
-	result.push_back (0);
-
-	// initialize shift
-	size_t shift = 7;
-
 	// encode every byte
-	const uint8_t *start = buffer;
 #ifndef NDEBUG
 	const uint8_t *end = buffer + len;
 #endif
@@ -167,7 +168,7 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 		assert (buffer < end);
 		assert (buffer + len == end);
 
-		const uint8_t *tmp;
+		const uint8_t *tmp = nullptr;
 		size_t tmplen;
 
 		if (buffer != start)
@@ -220,12 +221,60 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 		}
 
 		if (tmplen < 3)
+		{
+			// this is a copy chunk; only one byte is copied
+			tokens.emplace_back (Token{1, 0});
+			tmplen = 1;
+		}
+		else
+			tokens.emplace_back (Token{static_cast<uint32_t> (tmplen),
+			    static_cast<uint32_t> (buffer - tmp - 1)});
+
+		// advance input buffer
+		buffer += tmplen;
+		len -= tmplen;
+	}
+}
+
+/** @brief Emit LZSS/LZ10/LZ11 stream
+ *  @param[in] buffer Source buffer
+ *  @param[in] len    Source length
+ *  @param[in] mode   LZ mode
+ *  @param[in] tokens Tokens covering the source buffer
+ *  @returns Compressed buffer
+ */
+std::vector<uint8_t> lzssEmit (const uint8_t *buffer,
+    size_t len,
+    LZSS_t mode,
+    const std::vector<Token> &tokens)
+{
+	// create output buffer
+	std::vector<uint8_t> result;
+
+	// append compression header
+	if (mode == LZ10)
+		compressionHeader (result, 0x10, len);
+	else
+		compressionHeader (result, 0x11, len);
+
+	// reserve an encode byte in output buffer
+	size_t code_pos = result.size ();
+	result.push_back (0);
+
+	// initialize shift
+	size_t shift = 7;
+
+	for (const auto &token : tokens)
+	{
+		const size_t tmplen = token.len;
+		const size_t disp   = token.disp;
+
+		assert (tmplen <= len);
+
+		if (tmplen == 1)
 		{
 			// this is a copy chunk; append this byte to the output buffer
 			result.push_back (*buffer);
-
-			// only one byte is copied
-			tmplen = 1;
 		}
 		else if (mode == LZ10)
 		{
@@ -234,7 +283,6 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 			result[code_pos] |= (1 << shift);
 
 			// encode the displacement and length
-			size_t disp = buffer - tmp - 1;
 			assert (tmplen - 3 <= 0xF);
 			assert (disp <= 0xFFF);
 			result.push_back (((tmplen - 3) << 4) | (disp >> 8));
@@ -247,7 +295,6 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 			result[code_pos] |= (1 << shift);
 
 			// encode the displacement and length
-			size_t disp = buffer - tmp - 1;
 			assert (tmplen > 2);
 			assert (tmplen - 1 <= 0xF);
 			assert (disp <= 0xFFF);
@@ -261,7 +308,6 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 			result[code_pos] |= (1 << shift);
 
 			// encode the displacement and length
-			size_t disp = buffer - tmp - 1;
 			assert (tmplen >= 0x11);
 			assert (tmplen - 0x11 <= 0xFF);
 			assert (disp <= 0xFFF);
@@ -276,7 +322,6 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 			result[code_pos] |= (1 << shift);
 
 			// encode the displacement and length
-			size_t disp = buffer - tmp - 1;
 			assert (tmplen >= 0x111);
 			assert (tmplen - 0x111 <= 0xFFFF);
 			assert (disp <= 0xFFF);
@@ -303,6 +348,8 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 			--shift;
 	}
 
+	assert (len == 0);
+
 	// pad the output buffer to 4 bytes
 	if (result.size () & 0x3)
 		result.resize ((result.size () + 3) & ~0x3);
@@ -310,6 +357,71 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 	// return the output data
 	return result;
 }
+
+/** @brief LZSS/LZ10/LZ11 compression
+ *  @param[in] buffer Source buffer
+ *  @param[in] len    Source length
+ *  @param[in] mode   LZ mode
+ *  @returns Compressed buffer
+ */
+std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t mode)
+{
+	std::vector<Token> tokens;
+	lzssTokenize (buffer, buffer, len, mode, tokens);
+
+	return lzssEmit (buffer, len, mode, tokens);
+}
+
+/** @brief Parallel LZSS/LZ10/LZ11 compression
+ *  @param[in] buffer Source buffer
+ *  @param[in] len    Source length
+ *  @param[in] mode   LZ mode
+ *  @returns Compressed buffer
+ */
+std::vector<uint8_t> lzssCommonParallelEncode (const uint8_t *buffer, size_t len, LZSS_t mode)
+{
+	const size_t num_chunks = (len + LZ_PARALLEL_CHUNK - 1) / LZ_PARALLEL_CHUNK;
+	if (num_chunks <= 1)
+		return lzssCommonEncode (buffer, len, mode);
+
+	// tokenize each chunk; the chunk size is fixed so the output does not
+	// depend on the number of threads
+	std::vector<std::vector<Token>> chunks (num_chunks);
+	std::atomic<size_t> next_chunk (0);
+
+	auto worker = [&]() {
+		size_t chunk;
+		while ((chunk = next_chunk++) < num_chunks)
+		{
+			const size_t offset = chunk * LZ_PARALLEL_CHUNK;
+			lzssTokenize (buffer,
+			    buffer + offset,
+			    std::min<size_t> (LZ_PARALLEL_CHUNK, len - offset),
+			    mode,
+			    chunks[chunk]);
+		}
+	};
+
+	jobs::Reservation reservation (num_chunks);
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < reservation.threads (); ++i)
+		workers.emplace_back (worker);
+
+	worker ();
+
+	for (auto &thread : workers)
+		thread.join ();
+
+	// concatenate the tokens into a single stream
+	std::vector<Token> tokens;
+	for (auto &chunk : chunks)
+	{
+		tokens.insert (std::end (tokens), std::begin (chunk), std::end (chunk));
+		std::vector<Token> ().swap (chunk);
+	}
+
+	return lzssEmit (buffer, len, mode, tokens);
+}
 }
 
 std::vector<uint8_t> lzssEncode (const void *src, size_t len)
@@ -322,6 +434,16 @@ std::vector<uint8_t> lz11Encode (const void *src, size_t len)
 	return lzssCommonEncode (reinterpret_cast<const uint8_t *> (src), len, LZ11);
 }
 
+std::vector<uint8_t> lzssParallelEncode (const void *src, size_t len)
+{
+	return lzssCommonParallelEncode (reinterpret_cast<const uint8_t *> (src), len, LZ10);
+}
+
+std::vector<uint8_t> lz11ParallelEncode (const void *src, size_t len)
+{
+	return lzssCommonParallelEncode (reinterpret_cast<const uint8_t *> (src), len, LZ11);
+}
+
 void lzssDecode (const void *source, void *dest, size_t size)
 {
 	const uint8_t *src = (const uint8_t *)source;
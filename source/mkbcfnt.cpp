@@ -22,8 +22,11 @@
  *  @brief mkbcfnt program entry point
  */
 #include "bcfnt.h"
+#include "corpus.h"
 #include "freetype.h"
 #include "future.h"
+#include "jobs.h"
+#include "stats.h"
 
 #include <getopt.h>
 
@@ -33,6 +36,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <iterator>
 #include <string>
 
 namespace
@@ -69,12 +73,23 @@ void printUsage (const char *prog)
 	std::printf (
 	    "  Options:\n"
 	    "    -h, --help                   Show this help message\n"
+	    "    -j, --jobs <n>               Number of threads, shared with ImageMagick\n"
+	    "                                 (default: number of hardware threads)\n"
 	    "    -o, --output <output>        Output file\n"
 	    "    -s, --size <size>            Set font size in points\n"
 	    "    -b, --blacklist <file>       Excludes the whitespace-separated list of codepoints\n"
+	    "    -c, --corpus <file>          Includes only codepoints used by UTF-8/UTF-16 text file.\n"
+	    "                                 May be repeated; merged with -w and filtered by -b\n"
 	    "    -w, --whitelist <file>       Includes only the whitespace-separated list of "
 	    "codepoints\n"
 	    "    -v, --version                Show version and copyright information\n"
+	    "    -z, --compress <compression> Compress output. Valid options: none (default), lz10, "
+	    "lz11\n"
+	    "    --sheet-size <size>          Glyph sheet size: auto (default) or WxH, where W and H are\n"
+	    "                                 powers of two from 8 to 1024\n"
+	    "    --memory-limit <MiB>         Limit ImageMagick pixel cache memory; the rest goes to disk\n"
+	    "    --stats                      Print stage timings and a glyph render time histogram\n"
+	    "    --verify                     Check the written font against the rendered glyphs\n"
 	    "    <inputN>                     Input file(s). Lower numbers get priority\n\n");
 }
 
@@ -109,16 +124,60 @@ bool parseList (std::vector<std::uint16_t> &out, const char *path)
 	return true;
 }
 
+/** @brief Parse sheet size option
+ *  @param[in]  str    Option argument
+ *  @param[out] width  Sheet width; 0 for automatic
+ *  @param[out] height Sheet height; 0 for automatic
+ *  @returns whether successful
+ */
+bool parseSheetSize (const char *str, std::uint16_t &width, std::uint16_t &height)
+{
+	if (strcasecmp (str, "auto") == 0)
+	{
+		width = height = 0;
+		return true;
+	}
+
+	unsigned w, h;
+	char extra;
+	if (std::sscanf (str, "%ux%u%c", &w, &h, &extra) != 2)
+		return false;
+
+	auto valid = [](unsigned dim) { return dim >= 8 && dim <= 1024 && !(dim & (dim - 1)); };
+	if (!valid (w) || !valid (h))
+		return false;
+
+	width  = w;
+	height = h;
+	return true;
+}
+
+/** @brief Options without a short form */
+enum LongOption
+{
+	OPT_SHEET_SIZE = 0x100,
+	OPT_MEMORY_LIMIT,
+	OPT_STATS,
+	OPT_VERIFY,
+};
+
 /** @brief Program long options */
 const struct option longOptions[] = {
     /* clang-format off */
-	{ "blacklist", required_argument, nullptr, 'b', },
-	{ "help",      no_argument,       nullptr, 'h', },
-	{ "output",    required_argument, nullptr, 'o', },
-	{ "size",      required_argument, nullptr, 's', },
-	{ "version",   no_argument,       nullptr, 'v', },
-	{ "whitelist", required_argument, nullptr, 'w', },
-	{ nullptr,     no_argument,       nullptr,   0, },
+	{ "blacklist",    required_argument, nullptr,              'b', },
+	{ "corpus",       required_argument, nullptr,              'c', },
+	{ "help",         no_argument,       nullptr,              'h', },
+	{ "jobs",         required_argument, nullptr,              'j', },
+	{ "output",       required_argument, nullptr,              'o', },
+	{ "size",         required_argument, nullptr,              's', },
+	{ "version",      no_argument,       nullptr,              'v', },
+	{ "whitelist",    required_argument, nullptr,              'w', },
+	{ "compress",     required_argument, nullptr,              'z', },
+	{ "sheet-size",   required_argument, nullptr, OPT_SHEET_SIZE,   },
+	{ "memory-limit", required_argument, nullptr, OPT_MEMORY_LIMIT, },
+	{ "stats",        no_argument,       nullptr, OPT_STATS,        },
+	{ "verify",       no_argument,       nullptr, OPT_VERIFY,       },
+	{ nullptr,        no_argument,       nullptr,                0, },
     /* clang-format on */
 };
 }
@@ -131,6 +190,7 @@ const struct option longOptions[] = {
  */
 int main (int argc, char *argv[])
 {
+	const auto start = stats::Clock::now ();
 	const char *prog = argv[0];
 
 	// set line buffering
@@ -139,12 +199,22 @@ int main (int argc, char *argv[])
 
 	std::string outputPath;
 	std::vector<std::uint16_t> list;
+	std::vector<std::string> corpusPaths;
 	bool isBlacklist = true;
 	double ptSize    = 22.0;
 
+	bcfnt::Compression compression = bcfnt::COMPRESSION_NONE;
+
+	std::uint16_t sheetWidth  = 0;
+	std::uint16_t sheetHeight = 0;
+
+	unsigned jobsCount = 0;
+	size_t memoryLimit = 0;
+	bool verify        = false;
+
 	// parse options
 	int c;
-	while ((c = ::getopt_long (argc, argv, "b:ho:s:vw:", longOptions, nullptr)) != -1)
+	while ((c = ::getopt_long (argc, argv, "b:c:hj:o:s:vw:z:", longOptions, nullptr)) != -1)
 	{
 		switch (c)
 		{
@@ -153,6 +223,15 @@ int main (int argc, char *argv[])
 			printUsage (prog);
 			return EXIT_SUCCESS;
 
+		case 'j':
+			// set thread budget
+			if (!jobs::parseCount (optarg, jobsCount))
+			{
+				std::fprintf (stderr, "Invalid number of jobs '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+
 		case 'o':
 			// set output path option
 			outputPath = optarg;
@@ -187,12 +266,60 @@ int main (int argc, char *argv[])
 			isBlacklist = true;
 			break;
 
+		case 'c':
+			// add corpus
+			corpusPaths.emplace_back (optarg);
+			break;
+
 		case 'w':
 			// set whitelist
 			parseList (list, optarg);
 			isBlacklist = false;
 			break;
 
+		case 'z':
+			// set compression
+			if (strcasecmp (optarg, "none") == 0)
+				compression = bcfnt::COMPRESSION_NONE;
+			else if (strcasecmp (optarg, "lz10") == 0 || strcasecmp (optarg, "lzss") == 0)
+				compression = bcfnt::COMPRESSION_LZ10;
+			else if (strcasecmp (optarg, "lz11") == 0)
+				compression = bcfnt::COMPRESSION_LZ11;
+			else
+			{
+				std::fprintf (stderr, "Invalid compression option '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case OPT_SHEET_SIZE:
+			// set sheet size
+			if (!parseSheetSize (optarg, sheetWidth, sheetHeight))
+			{
+				std::fprintf (stderr, "Invalid sheet size '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case OPT_MEMORY_LIMIT:
+			// set ImageMagick memory limit
+			if (!jobs::parseMemoryLimit (optarg, memoryLimit))
+			{
+				std::fprintf (stderr, "Invalid memory limit '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case OPT_STATS:
+			// print statistics
+			stats::enabled = true;
+			break;
+
+		case OPT_VERIFY:
+			// verify output
+			verify = true;
+			break;
+
 		default:
 			printUsage (prog);
 			return EXIT_FAILURE;
@@ -213,16 +340,52 @@ int main (int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	// share the thread budget with ImageMagick; glyphs are rendered on the thread pool
+	jobs::setCount (jobsCount);
+	if (memoryLimit)
+		jobs::setMemoryLimit (memoryLimit);
+	jobs::SerialMagick serialMagick;
+
 	// collect input paths
 	std::vector<std::string> inputs;
 	while (optind < argc)
 		inputs.emplace_back (argv[optind++]);
 
+	// restrict glyphs to the code points used by the corpus
+	if (!corpusPaths.empty ())
+	{
+		std::vector<std::uint16_t> codes;
+		if (!corpus::scan (corpusPaths, codes))
+			return EXIT_FAILURE;
+
+		std::vector<std::uint16_t> merged;
+		if (isBlacklist)
+		{
+			std::set_difference (std::begin (codes),
+			    std::end (codes),
+			    std::begin (list),
+			    std::end (list),
+			    std::back_inserter (merged));
+		}
+		else
+		{
+			std::set_union (std::begin (codes),
+			    std::end (codes),
+			    std::begin (list),
+			    std::end (list),
+			    std::back_inserter (merged));
+		}
+
+		list        = std::move (merged);
+		isBlacklist = false;
+	}
+
 	auto library = freetype::Library::makeLibrary ();
 	if (!library)
 		return EXIT_FAILURE;
 
 	auto bcfnt = future::make_unique<bcfnt::BCFNT> ();
+	bcfnt->setSheetSize (sheetWidth, sheetHeight);
 	for (const auto &input : inputs)
 	{
 		FILE *fp = std::fopen (input.c_str (), "rb");
@@ -316,5 +479,20 @@ int main (int argc, char *argv[])
 		bcfnt->addFont (*font, list, isBlacklist);
 	}
 
-	return bcfnt->serialize (outputPath) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (!bcfnt->serialize (outputPath, compression))
+		return EXIT_FAILURE;
+
+	if (verify && !bcfnt->verify (outputPath))
+		return EXIT_FAILURE;
+
+	if (stats::enabled)
+	{
+		stats::addTime ("total", stats::Clock::now () - start);
+
+		std::printf ("Statistics:\n");
+		stats::print (stdout);
+		stats::printAllocations (stdout);
+	}
+
+	return EXIT_SUCCESS;
 }
@@ -0,0 +1,120 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file phf.cpp
+ *  @brief Minimal perfect hashing
+ */
+
+#include "phf.h"
+
+#include <algorithm>
+
+/** @brief Largest displacement to try for a bucket */
+#define PHF_MAX_DISPLACE 0x1000000
+
+uint32_t phf::hash (uint32_t seed, const std::string &key)
+{
+	uint32_t h = 0x811C9DC5u ^ seed;
+	for (const auto &c : key)
+	{
+		h ^= static_cast<uint8_t> (c);
+		h *= 0x01000193u;
+	}
+
+	return h;
+}
+
+bool phf::build (const std::vector<std::string> &keys,
+    std::vector<int32_t> &displace,
+    std::vector<size_t> &slots)
+{
+	const size_t n = keys.size ();
+
+	displace.assign (n, 0);
+	slots.assign (n, n);
+
+	// group keys into buckets
+	std::vector<std::vector<size_t>> buckets (n);
+	for (size_t i = 0; i < n; ++i)
+		buckets[hash (0, keys[i]) % n].emplace_back (i);
+
+	// place the largest buckets first while there are many free slots
+	std::vector<size_t> order (n);
+	for (size_t i = 0; i < n; ++i)
+		order[i] = i;
+
+	std::stable_sort (std::begin (order), std::end (order), [&](size_t lhs, size_t rhs) {
+		return buckets[lhs].size () > buckets[rhs].size ();
+	});
+
+	size_t pos = 0;
+	for (; pos < n && buckets[order[pos]].size () > 1; ++pos)
+	{
+		const auto &bucket = buckets[order[pos]];
+
+		std::vector<size_t> placed;
+		uint32_t d = 1;
+		for (; d < PHF_MAX_DISPLACE; ++d)
+		{
+			placed.clear ();
+			for (const auto &key : bucket)
+			{
+				const size_t slot = hash (d, keys[key]) % n;
+				if (slots[slot] != n || std::find (std::begin (placed), std::end (placed), slot) !=
+				                            std::end (placed))
+					break;
+
+				placed.emplace_back (slot);
+			}
+
+			if (placed.size () == bucket.size ())
+				break;
+		}
+
+		if (d == PHF_MAX_DISPLACE)
+			return false;
+
+		for (size_t i = 0; i < bucket.size (); ++i)
+			slots[placed[i]] = bucket[i];
+
+		displace[order[pos]] = d;
+	}
+
+	// single-key buckets go straight to the remaining free slots
+	size_t free = 0;
+	for (; pos < n && buckets[order[pos]].size () == 1; ++pos)
+	{
+		while (slots[free] != n)
+			++free;
+
+		slots[free]          = buckets[order[pos]].front ();
+		displace[order[pos]] = -static_cast<int32_t> (free) - 1;
+	}
+
+	return true;
+}
+
+size_t phf::lookup (const std::vector<int32_t> &displace, const std::string &key)
+{
+	const int32_t d = displace[hash (0, key) % displace.size ()];
+	if (d < 0)
+		return -d - 1;
+
+	return hash (d, key) % displace.size ();
+}
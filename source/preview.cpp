@@ -0,0 +1,340 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file preview.cpp
+ *  @brief Asynchronous preview writer
+ */
+
+#include "preview.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <strings.h>
+#include <vector>
+
+namespace
+{
+/** @brief Preview file format */
+enum Format
+{
+	FORMAT_PNG,    ///< Built-in PNG writer
+	FORMAT_QOI,    ///< Built-in QOI writer
+	FORMAT_MAGICK, ///< ImageMagick writer
+};
+
+/** @brief Outstanding previews */
+std::vector<std::future<bool>> pending;
+
+/** @brief Outstanding previews mutex */
+std::mutex pending_mutex;
+
+/** @brief Append big-endian 32-bit value
+ *  @param[in] out   Output buffer
+ *  @param[in] value Value to append
+ */
+void put32 (std::vector<uint8_t> &out, uint32_t value)
+{
+	out.emplace_back (value >> 24);
+	out.emplace_back (value >> 16);
+	out.emplace_back (value >> 8);
+	out.emplace_back (value >> 0);
+}
+
+/** @brief Append PNG chunk
+ *  @param[in] out  Output buffer
+ *  @param[in] type Chunk type
+ *  @param[in] data Chunk data
+ *  @param[in] size Chunk data size
+ */
+void putChunk (std::vector<uint8_t> &out, const char *type, const uint8_t *data, size_t size)
+{
+	put32 (out, size);
+
+	const size_t start = out.size ();
+	out.insert (out.end (), type, type + 4);
+	out.insert (out.end (), data, data + size);
+
+	put32 (out, crc32 (0, &out[start], out.size () - start));
+}
+
+/** @brief Encode PNG
+ *  @param[in]  rgba   RGBA pixels
+ *  @param[in]  width  Image width
+ *  @param[in]  height Image height
+ *  @param[out] out    Encoded image
+ *  @returns whether successful
+ */
+bool encodePNG (const uint8_t *rgba, size_t width, size_t height, std::vector<uint8_t> &out)
+{
+	static const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	out.assign (std::begin (signature), std::end (signature));
+
+	uint8_t ihdr[13];
+	ihdr[0]  = width >> 24;
+	ihdr[1]  = width >> 16;
+	ihdr[2]  = width >> 8;
+	ihdr[3]  = width >> 0;
+	ihdr[4]  = height >> 24;
+	ihdr[5]  = height >> 16;
+	ihdr[6]  = height >> 8;
+	ihdr[7]  = height >> 0;
+	ihdr[8]  = 8; // bit depth
+	ihdr[9]  = 6; // truecolor with alpha
+	ihdr[10] = 0; // deflate
+	ihdr[11] = 0; // adaptive filtering
+	ihdr[12] = 0; // no interlace
+	putChunk (out, "IHDR", ihdr, sizeof (ihdr));
+
+	// the Sub filter is cheap and helps the flat regions of previews
+	const size_t stride = width * 4;
+	std::vector<uint8_t> filtered ((stride + 1) * height);
+	for (size_t y = 0; y < height; ++y)
+	{
+		const uint8_t *src = rgba + y * stride;
+		uint8_t *dst       = &filtered[y * (stride + 1)];
+
+		*dst++ = 1;
+		std::memcpy (dst, src, std::min<size_t> (4, stride));
+		for (size_t x = 4; x < stride; ++x)
+			dst[x] = src[x] - src[x - 4];
+	}
+
+	uLongf size = compressBound (filtered.size ());
+	std::vector<uint8_t> idat (size);
+	if (compress2 (idat.data (), &size, filtered.data (), filtered.size (), Z_BEST_SPEED) != Z_OK)
+		return false;
+
+	putChunk (out, "IDAT", idat.data (), size);
+	putChunk (out, "IEND", nullptr, 0);
+	return true;
+}
+
+/** @brief Encode QOI
+ *  @param[in]  rgba   RGBA pixels
+ *  @param[in]  width  Image width
+ *  @param[in]  height Image height
+ *  @param[out] out    Encoded image
+ */
+void encodeQOI (const uint8_t *rgba, size_t width, size_t height, std::vector<uint8_t> &out)
+{
+	out.clear ();
+	out.insert (out.end (), {'q', 'o', 'i', 'f'});
+	put32 (out, width);
+	put32 (out, height);
+	out.emplace_back (4); // channels
+	out.emplace_back (0); // sRGB with linear alpha
+
+	uint8_t index[64][4] = {};
+	uint8_t prev[4]      = {0, 0, 0, 255};
+	unsigned run         = 0;
+
+	const size_t num = width * height;
+	for (size_t i = 0; i < num; ++i)
+	{
+		const uint8_t *px = &rgba[i * 4];
+
+		if (std::memcmp (px, prev, 4) == 0)
+		{
+			// QOI_OP_RUN
+			if (++run == 62 || i + 1 == num)
+			{
+				out.emplace_back (0xC0 | (run - 1));
+				run = 0;
+			}
+			continue;
+		}
+
+		if (run)
+		{
+			out.emplace_back (0xC0 | (run - 1));
+			run = 0;
+		}
+
+		const unsigned hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+		if (std::memcmp (index[hash], px, 4) == 0)
+		{
+			// QOI_OP_INDEX
+			out.emplace_back (hash);
+		}
+		else
+		{
+			std::memcpy (index[hash], px, 4);
+
+			if (px[3] == prev[3])
+			{
+				const int8_t dr    = px[0] - prev[0];
+				const int8_t dg    = px[1] - prev[1];
+				const int8_t db    = px[2] - prev[2];
+				const int8_t dr_dg = dr - dg;
+				const int8_t db_dg = db - dg;
+
+				if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+				{
+					// QOI_OP_DIFF
+					out.emplace_back (0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+				}
+				else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 &&
+				         db_dg <= 7)
+				{
+					// QOI_OP_LUMA
+					out.emplace_back (0x80 | (dg + 32));
+					out.emplace_back ((dr_dg + 8) << 4 | (db_dg + 8));
+				}
+				else
+				{
+					// QOI_OP_RGB
+					out.insert (out.end (), {0xFE, px[0], px[1], px[2]});
+				}
+			}
+			else
+			{
+				// QOI_OP_RGBA
+				out.insert (out.end (), {0xFF, px[0], px[1], px[2], px[3]});
+			}
+		}
+
+		std::memcpy (prev, px, 4);
+	}
+
+	// end marker
+	out.insert (out.end (), {0, 0, 0, 0, 0, 0, 0, 1});
+}
+
+/** @brief Write file
+ *  @param[in] path Output path
+ *  @param[in] data File contents
+ *  @returns whether successful
+ */
+bool writeFile (const std::string &path, const std::vector<uint8_t> &data)
+{
+	FILE *fp = std::fopen (path.c_str (), "wb");
+	if (!fp)
+		return false;
+
+	const bool written = std::fwrite (data.data (), 1, data.size (), fp) == data.size ();
+	return std::fclose (fp) == 0 && written;
+}
+
+/** @brief Write preview with ImageMagick
+ *  @param[in] img  Preview image
+ *  @param[in] path Output path
+ *  @returns whether successful
+ */
+bool writeMagick (Magick::Image img, const std::string &path)
+{
+	try
+	{
+		// output the preview image
+		img.write (path);
+		return true;
+	}
+	catch (...)
+	{
+		return false;
+	}
+}
+
+/** @brief Get preview format from output path
+ *  @param[in] path Output path
+ *  @returns preview format
+ */
+Format getFormat (const std::string &path)
+{
+	const size_t slash = path.find_last_of ('/');
+	const size_t dot   = path.find_last_of ('.');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return FORMAT_PNG;
+
+	const std::string ext = path.substr (dot + 1);
+	if (strcasecmp (ext.c_str (), "qoi") == 0)
+		return FORMAT_QOI;
+	if (strcasecmp (ext.c_str (), "png") == 0)
+		return FORMAT_PNG;
+
+	// let ImageMagick decide; unknown extensions fall back to PNG
+	try
+	{
+		Magick::Image probe;
+		probe.magick (ext);
+		return FORMAT_MAGICK;
+	}
+	catch (...)
+	{
+		return FORMAT_PNG;
+	}
+}
+}
+
+void preview::write (const Magick::Image &img, const std::string &path)
+{
+	const Format format = getFormat (path);
+
+	std::future<bool> future;
+	if (format == FORMAT_MAGICK)
+		future = std::async (std::launch::async, writeMagick, img, path);
+	else
+	{
+		// export the pixels here; encoding and writing run in the background
+		const size_t width  = img.columns ();
+		const size_t height = img.rows ();
+		std::vector<uint8_t> rgba (width * height * 4);
+		img.write (0, 0, width, height, "RGBA", Magick::CharPixel, rgba.data ());
+
+		future = std::async (std::launch::async, [format, width, height, path](
+		                                              const std::vector<uint8_t> &pixels) {
+			std::vector<uint8_t> data;
+			if (format == FORMAT_QOI)
+				encodeQOI (pixels.data (), width, height, data);
+			else if (!encodePNG (pixels.data (), width, height, data))
+				return false;
+
+			return writeFile (path, data);
+		}, std::move (rgba));
+	}
+
+	std::lock_guard<std::mutex> lock (pending_mutex);
+	pending.emplace_back (std::move (future));
+}
+
+bool preview::wait ()
+{
+	std::vector<std::future<bool>> futures;
+	{
+		std::lock_guard<std::mutex> lock (pending_mutex);
+		futures.swap (pending);
+	}
+
+	bool success = true;
+	for (auto &future : futures)
+	{
+		if (!future.get ())
+		{
+			std::fprintf (stderr, "Failed to output preview\n");
+			success = false;
+		}
+	}
+
+	return success;
+}
@@ -1392,6 +1392,8 @@ namespace rg_etc1
 
             m_base_color5.clear();
             m_constrain_against_base_color5 = false;
+
+            m_subblock_error_target = 0;
          }
 
          uint32_t m_num_src_pixels;
@@ -1403,6 +1405,9 @@ namespace rg_etc1
 
          color_quad_u8 m_base_color5;
          bool m_constrain_against_base_color5;
+
+         // Per-subblock share of etc1_pack_params::m_error_target (0 = disabled).
+         uint64_t m_subblock_error_target;
       };
 
       struct results
@@ -1476,22 +1481,25 @@ namespace rg_etc1
    {
       const uint32_t n = m_pParams->m_num_src_pixels;
       const int scan_delta_size = m_pParams->m_scan_delta_size;
+      const uint64_t error_target = m_pParams->m_subblock_error_target;
 
       // Scan through a subset of the 3D lattice centered around the avg block color trying each 3D (555 or 444) lattice point as a potential block color.
       // Each time a better solution is found try to refine the current solution's block color based of the current selectors and intensity table index.
-      for (int zdi = 0; zdi < scan_delta_size; zdi++)
+      // If an error target is set, stop as soon as the best solution meets it.
+      bool target_met = false;
+      for (int zdi = 0; (zdi < scan_delta_size) && (!target_met); zdi++)
       {
          const int zd = m_pParams->m_pScan_deltas[zdi];
          const int mbb = m_bb + zd;
          if (mbb < 0) continue; else if (mbb > m_limit) break;
 
-         for (int ydi = 0; ydi < scan_delta_size; ydi++)
+         for (int ydi = 0; (ydi < scan_delta_size) && (!target_met); ydi++)
          {
             const int yd = m_pParams->m_pScan_deltas[ydi];
             const int mbg = m_bg + yd;
             if (mbg < 0) continue; else if (mbg > m_limit) break;
 
-            for (int xdi = 0; xdi < scan_delta_size; xdi++)
+            for (int xdi = 0; (xdi < scan_delta_size) && (!target_met); xdi++)
             {
                const int xd = m_pParams->m_pScan_deltas[xdi];
                const int mbr = m_br + xd;
@@ -1509,6 +1517,12 @@ namespace rg_etc1
                      continue;
                }
 
+               if ((error_target) && (m_best_solution.m_error <= error_target))
+               {
+                  target_met = true;
+                  break;
+               }
+
                // Now we have the input block, the avg. color of the input pixels, a set of trial selector indices, and the block color+intensity index.
                // Now, for each component, attempt to refine the current solution by solving a simple linear equation. For example, for 4 colors:
                // The goal is:
@@ -1576,6 +1590,12 @@ namespace rg_etc1
                         break;
                   }
 
+                  if ((error_target) && (m_best_solution.m_error <= error_target))
+                  {
+                     target_met = true;
+                     break;
+                  }
+
                }  // refinement_trial
 
             } // xdi
@@ -2239,10 +2259,16 @@ found_perfect_match:
       etc1_optimizer::params params(pack_params);
       params.m_num_src_pixels = 8;
       params.m_pSrc_pixels = subblock_pixels;
+      // Round the per-subblock share down, so two subblocks that each meet it stay within the block target.
+      // A target of 1 still needs a nonzero share; the combined error is checked against the block target below.
+      params.m_subblock_error_target = pack_params.m_error_target / 2;
+      if ((pack_params.m_error_target) && (!params.m_subblock_error_target))
+         params.m_subblock_error_target = 1;
 
-      for (uint32_t flip = 0; flip < 2; flip++)
+      bool target_met = false;
+      for (uint32_t flip = 0; (flip < 2) && (!target_met); flip++)
       {
-         for (uint32_t use_color4 = 0; use_color4 < 2; use_color4++)
+         for (uint32_t use_color4 = 0; (use_color4 < 2) && (!target_met); use_color4++)
          {
             uint64_t trial_error = 0;
 
@@ -2308,7 +2334,8 @@ found_perfect_match:
                   // TODO: Fix fairly arbitrary/unrefined thresholds that control how far away to scan for potentially better solutions.
                   const uint32_t refinement_error_thresh0 = 3000;
                   const uint32_t refinement_error_thresh1 = 6000;
-                  if (results[subblock].m_error > refinement_error_thresh0)
+                  const bool subblock_target_met = (params.m_subblock_error_target) && (results[subblock].m_error <= params.m_subblock_error_target);
+                  if ((results[subblock].m_error > refinement_error_thresh0) && (!subblock_target_met))
                   {
                      if (params.m_quality == cMediumQuality)
                      {
@@ -2354,6 +2381,9 @@ found_perfect_match:
             best_flip = flip;
             best_use_color4 = use_color4;
 
+            if ((pack_params.m_error_target) && (best_error <= pack_params.m_error_target))
+               target_met = true;
+
          } // use_color4
 
       } // flip
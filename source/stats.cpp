@@ -0,0 +1,374 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file stats.cpp
+ *  @brief Run statistics
+ */
+
+#include "stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef ALLOC_STATS
+/** @brief Maximum number of allocation stages, including "other" */
+#define ALLOC_MAX_STAGES 16
+
+/** @brief Maximum number of threads counted separately; the last slot is shared */
+#define ALLOC_MAX_THREADS 256
+#endif
+
+namespace
+{
+/** @brief Named statistic */
+struct Stat
+{
+	std::string name;            ///< Statistic name
+	bool timer;                  ///< Whether this is a timer
+	stats::Clock::duration time; ///< Accumulated time
+	uint64_t count;              ///< Accumulated count
+};
+
+/** @brief Statistics in order of first use */
+std::vector<Stat> stat_list;
+
+/** @brief Statistics mutex */
+std::mutex stat_mutex;
+
+/** @brief Find or create a statistic
+ *  @param[in] name  Statistic name
+ *  @param[in] timer Whether this is a timer
+ *  @returns statistic
+ */
+Stat &getStat (const char *name, bool timer)
+{
+	for (auto &stat : stat_list)
+	{
+		if (stat.name == name)
+			return stat;
+	}
+
+	stat_list.emplace_back (Stat{name, timer, stats::Clock::duration::zero (), 0});
+	return stat_list.back ();
+}
+
+#ifdef ALLOC_STATS
+/** @brief Allocation counters of one thread */
+struct ThreadAllocs
+{
+	std::atomic<uint64_t> count[ALLOC_MAX_STAGES]; ///< Allocations per stage
+	std::atomic<uint64_t> bytes[ALLOC_MAX_STAGES]; ///< Bytes allocated per stage
+};
+
+/** @brief Allocation counters, in order of each thread's first allocation */
+ThreadAllocs thread_allocs[ALLOC_MAX_THREADS];
+
+/** @brief Number of threads that have allocated */
+std::atomic<unsigned> num_threads (0);
+
+/** @brief This thread's allocation counters */
+thread_local ThreadAllocs *current_allocs = nullptr;
+
+/** @brief Stage names; stage 0 is outside of any stage */
+const char *stage_names[ALLOC_MAX_STAGES] = {"other"};
+
+/** @brief Number of stages */
+unsigned num_stages = 1;
+
+/** @brief Current stage */
+std::atomic<unsigned> current_stage (0);
+
+/** @brief Count an allocation
+ *  @param[in] size Allocation size
+ *
+ *  @note Called from operator new; must not allocate
+ */
+void countAllocation (size_t size)
+{
+	if (!stats::enabled)
+		return;
+
+	if (!current_allocs)
+	{
+		const unsigned slot = num_threads.fetch_add (1, std::memory_order_relaxed);
+		current_allocs      = &thread_allocs[std::min (slot, ALLOC_MAX_THREADS - 1u)];
+	}
+
+	const unsigned stage = current_stage.load (std::memory_order_relaxed);
+	current_allocs->count[stage].fetch_add (1, std::memory_order_relaxed);
+	current_allocs->bytes[stage].fetch_add (size, std::memory_order_relaxed);
+}
+
+/** @brief Allocate memory for operator new
+ *  @param[in] size Allocation size
+ *  @returns allocated memory; nullptr on failure
+ */
+void *allocate (size_t size) noexcept
+{
+	countAllocation (size);
+
+	void *p;
+	while (!(p = std::malloc (size ? size : 1)))
+	{
+		std::new_handler handler = std::get_new_handler ();
+		if (!handler)
+			return nullptr;
+
+		try
+		{
+			handler ();
+		}
+		catch (...)
+		{
+			return nullptr;
+		}
+	}
+
+	return p;
+}
+#endif
+}
+
+#ifdef ALLOC_STATS
+void *operator new (std::size_t size)
+{
+	void *p = allocate (size);
+	if (!p)
+		throw std::bad_alloc ();
+
+	return p;
+}
+
+void *operator new[] (std::size_t size)
+{
+	return operator new (size);
+}
+
+void *operator new (std::size_t size, const std::nothrow_t &) noexcept
+{
+	return allocate (size);
+}
+
+void *operator new[] (std::size_t size, const std::nothrow_t &) noexcept
+{
+	return allocate (size);
+}
+
+void operator delete (void *p) noexcept
+{
+	std::free (p);
+}
+
+void operator delete[] (void *p) noexcept
+{
+	std::free (p);
+}
+
+void operator delete (void *p, const std::nothrow_t &) noexcept
+{
+	std::free (p);
+}
+
+void operator delete[] (void *p, const std::nothrow_t &) noexcept
+{
+	std::free (p);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete (void *p, std::size_t) noexcept
+{
+	std::free (p);
+}
+
+void operator delete[] (void *p, std::size_t) noexcept
+{
+	std::free (p);
+}
+#endif
+#endif
+
+bool stats::enabled = false;
+
+void stats::addTime (const char *name, Clock::duration duration)
+{
+	std::lock_guard<std::mutex> lock (stat_mutex);
+	getStat (name, true).time += duration;
+}
+
+void stats::addCount (const char *name, uint64_t count)
+{
+	std::lock_guard<std::mutex> lock (stat_mutex);
+	getStat (name, false).count += count;
+}
+
+uint64_t stats::getCount (const char *name)
+{
+	std::lock_guard<std::mutex> lock (stat_mutex);
+	for (const auto &stat : stat_list)
+	{
+		if (stat.name == name)
+			return stat.count;
+	}
+
+	return 0;
+}
+
+void stats::reset ()
+{
+	std::lock_guard<std::mutex> lock (stat_mutex);
+	stat_list.clear ();
+
+#ifdef ALLOC_STATS
+	for (auto &allocs : thread_allocs)
+	{
+		for (unsigned s = 0; s < ALLOC_MAX_STAGES; ++s)
+		{
+			allocs.count[s].store (0, std::memory_order_relaxed);
+			allocs.bytes[s].store (0, std::memory_order_relaxed);
+		}
+	}
+#endif
+}
+
+void stats::print (FILE *fp)
+{
+	std::lock_guard<std::mutex> lock (stat_mutex);
+	for (const auto &stat : stat_list)
+	{
+		if (stat.timer)
+		{
+			const double ms =
+			    std::chrono::duration_cast<std::chrono::duration<double, std::milli>> (stat.time)
+			        .count ();
+			std::fprintf (fp, "  %-28s %12.3f ms\n", stat.name.c_str (), ms);
+		}
+		else
+			std::fprintf (fp, "  %-28s %12" PRIu64 "\n", stat.name.c_str (), stat.count);
+	}
+}
+
+unsigned stats::enterStage (const char *name)
+{
+#ifdef ALLOC_STATS
+	const unsigned previous = current_stage.load (std::memory_order_relaxed);
+	if (!enabled)
+		return previous;
+
+	unsigned stage;
+	{
+		std::lock_guard<std::mutex> lock (stat_mutex);
+		for (stage = 0; stage < num_stages; ++stage)
+		{
+			if (std::strcmp (stage_names[stage], name) == 0)
+				break;
+		}
+
+		// count further stages as "other"
+		if (stage == num_stages)
+		{
+			if (num_stages < ALLOC_MAX_STAGES)
+				stage_names[num_stages++] = name;
+			else
+				stage = 0;
+		}
+	}
+
+	current_stage.store (stage, std::memory_order_relaxed);
+	return previous;
+#else
+	(void)name;
+	return 0;
+#endif
+}
+
+void stats::leaveStage (unsigned stage)
+{
+#ifdef ALLOC_STATS
+	current_stage.store (stage, std::memory_order_relaxed);
+#else
+	(void)stage;
+#endif
+}
+
+void stats::printAllocations (FILE *fp)
+{
+#ifdef ALLOC_STATS
+	const unsigned threads = std::min<unsigned> (num_threads, ALLOC_MAX_THREADS);
+
+	unsigned stages;
+	{
+		std::lock_guard<std::mutex> lock (stat_mutex);
+		stages = num_stages;
+	}
+
+	// sum the stage and thread totals first; printing allocates too
+	std::vector<uint64_t> stage_count (stages), stage_bytes (stages);
+	std::vector<uint64_t> thread_count (threads), thread_bytes (threads);
+	for (unsigned t = 0; t < threads; ++t)
+	{
+		for (unsigned s = 0; s < stages; ++s)
+		{
+			const uint64_t count = thread_allocs[t].count[s].load (std::memory_order_relaxed);
+			const uint64_t bytes = thread_allocs[t].bytes[s].load (std::memory_order_relaxed);
+
+			stage_count[s] += count;
+			stage_bytes[s] += bytes;
+			thread_count[t] += count;
+			thread_bytes[t] += bytes;
+		}
+	}
+
+	std::fprintf (fp, "Allocations (count, bytes):\n");
+	for (unsigned s = 0; s < stages; ++s)
+	{
+		std::fprintf (fp,
+		    "  %-28s %12" PRIu64 " %14" PRIu64 "\n",
+		    stage_names[s],
+		    stage_count[s],
+		    stage_bytes[s]);
+	}
+
+	for (unsigned t = 0; t < threads; ++t)
+	{
+		if (thread_count[t] == 0)
+			continue;
+
+		char name[32];
+		if (t == ALLOC_MAX_THREADS - 1 && num_threads > ALLOC_MAX_THREADS)
+			std::snprintf (name, sizeof (name), "threads %u+", t);
+		else
+			std::snprintf (name, sizeof (name), "thread %u", t);
+
+		std::fprintf (fp,
+		    "  %-28s %12" PRIu64 " %14" PRIu64 "\n",
+		    name,
+		    thread_count[t],
+		    thread_bytes[t]);
+	}
+#else
+	(void)fp;
+#endif
+}
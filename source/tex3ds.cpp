@@ -22,26 +22,43 @@
  */
 
 #include "atlas.h"
+#include "batch.h"
 #include "compress.h"
 #include "encode.h"
+#include "etc1_cache.h"
+#include "input_cache.h"
+#include "jobs.h"
 #include "magick_compat.h"
+#include "phf.h"
+#include "preview.h"
 #include "quantum.h"
 #include "rg_etc1.h"
+#include "stats.h"
 #include "subimage.h"
 #include "swizzle.h"
 #include "utility.h"
 
 #include <getopt.h>
 #include <libgen.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <climits>
 #include <cmath>
 #include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <map>
+#include <memory>
 #include <queue>
 #include <set>
 #include <stdexcept>
@@ -208,9 +225,43 @@ enum ProcessingMode
 	PROCESS_SKYBOX,  ///< Skybox
 };
 
+/** @brief Tile output mode */
+enum TileMode
+{
+	TILE_NONE,   ///< No tiling
+	TILE_FILES,  ///< One numbered output file per tile
+	TILE_BUNDLE, ///< All tiles in one output file
+};
+
+/** @brief Texture cut from an oversize image */
+struct Tile
+{
+	size_t x;          ///< Left edge in the source image
+	size_t y;          ///< Top edge in the source image
+	size_t width;      ///< Width in the source image
+	size_t height;     ///< Height in the source image
+	size_t tex_width;  ///< Texture width
+	size_t tex_height; ///< Texture height
+	size_t offset;     ///< Offset in the bundle
+	size_t size;       ///< Size in the bundle
+	std::string path;  ///< Output path
+};
+
 /** @brief Include stack */
 std::vector<std::string> include_stack (1);
 
+/** @brief Options files included with -i */
+std::vector<std::string> include_files;
+
+/** @brief Watch manifest path option */
+std::string watch_path;
+
+/** @brief Batch manifest path option */
+std::string batch_path;
+
+/** @brief Decoded input cache directory option */
+std::string input_cache_path;
+
 /** @brief Dependency path option */
 std::string depends_path;
 
@@ -223,6 +274,9 @@ std::string header_path;
 /** @brief Output path option */
 std::string output_path;
 
+/** @brief Sub-image lookup path option */
+std::string lookup_path;
+
 /** @brief Preview path option */
 std::string preview_path;
 
@@ -232,6 +286,27 @@ ProcessFormat process_format = RGBA8888;
 /** @brief ETC1 quality option */
 rg_etc1::etc1_quality etc1_quality = rg_etc1::cMediumQuality;
 
+/** @brief Use fast ETC1 encoder option */
+bool etc1_fast = false;
+
+/** @brief ETC1 per-block error target option */
+unsigned etc1_error_target = 0;
+
+/** @brief ETC1 cache path option */
+std::string etc1_cache_path;
+
+/** @brief ETC1 cache size option (MiB) */
+size_t etc1_cache_size = 64;
+
+/** @brief ETC1 block cache */
+std::unique_ptr<ETC1Cache> etc1_cache;
+
+/** @brief Path of the open ETC1 block cache */
+std::string etc1_cache_open_path;
+
+/** @brief Whether rg_etc1 has been initialized */
+bool etc1_initialized = false;
+
 /** @brief Compression format option */
 CompressionFormat compression_format = COMPRESSION_AUTO;
 
@@ -244,6 +319,27 @@ ProcessingMode process_mode = PROCESS_NORMAL;
 /** @brief Trim input images */
 bool trim = false;
 
+/** @brief Thread budget option; 0 for the number of hardware threads */
+unsigned jobs_count = 0;
+
+/** @brief ImageMagick memory limit option (MiB); 0 for no limit */
+size_t memory_limit = 0;
+
+/** @brief Batch memory budget option (MiB); 0 for no limit */
+size_t memory_budget = 0;
+
+/** @brief Tile output mode option */
+TileMode tile_mode = TILE_NONE;
+
+/** @brief Output tiles, in row-major order */
+std::vector<Tile> tiles;
+
+/** @brief Tile grid columns */
+size_t tile_cols = 0;
+
+/** @brief Tile grid rows */
+size_t tile_rows = 0;
+
 /** @brief Output subimage data */
 std::vector<SubImage> subimage_data;
 
@@ -271,6 +367,137 @@ unsigned border = 0;
 /** @brief Add an colored edge between atlased images */
 unsigned edge = 0;
 
+/** @brief Check cubemap/skybox face size
+ *  @param[in] width  Face width
+ *  @param[in] height Face height
+ */
+void check_face_size (size_t width, size_t height)
+{
+	// check for correct texture width
+	switch (width)
+	{
+	case 8:
+	case 16:
+	case 32:
+	case 64:
+	case 128:
+	case 256:
+	case 512:
+	case 1024:
+		break;
+
+	default:
+		throw std::runtime_error ("Invalid width");
+	}
+
+	// check for correct texture height
+	switch (height)
+	{
+	case 8:
+	case 16:
+	case 32:
+	case 64:
+	case 128:
+	case 256:
+	case 512:
+	case 1024:
+		break;
+
+	default:
+		throw std::runtime_error ("Invalid height");
+	}
+}
+
+/** @brief Orient cubemap/skybox face
+ *  @param[in] img  Face image
+ *  @param[in] face Face index, in px, nx, py, ny, pz, nz order
+ *  @returns oriented face
+ */
+Magick::Image orient_face (Magick::Image img, unsigned face)
+{
+	static const char *const names[] = {"px_", "nx_", "py_", "ny_", "pz_", "nz_"};
+
+	// PICA 200 cubemapping inverts texture vertical axis
+	const bool y_face = face == 2 || face == 3;
+	if (!y_face && process_mode == PROCESS_SKYBOX)
+		img.flop (); // flip horizontal
+	if (!y_face || process_mode == PROCESS_CUBEMAP)
+		img.flip (); // flip vertical
+
+	img.comment (names[face]);
+	return img;
+}
+
+/** @brief Load cubemap/skybox from separate face images
+ *  @param[in] paths Face paths, in px, nx, py, ny, pz, nz order
+ *  @returns vector of images to process
+ */
+std::vector<Magick::Image> load_faces (const std::vector<std::string> &paths)
+{
+	assert (paths.size () == 6);
+
+	// decode the faces in parallel
+	jobs::SerialMagick serial_magick;
+	std::vector<Magick::Image> faces (paths.size ());
+	std::vector<std::string> errors (paths.size ());
+	std::atomic<size_t> next (0);
+	auto worker = [&]() {
+		size_t i;
+		while ((i = next++) < paths.size ())
+		{
+			try
+			{
+				Magick::Image img = input_cache::image (paths[i]);
+
+				// Convert to RGBA
+				faces[i] = Magick::Image (img.size (), transparent ());
+				faces[i].composite (img, img.size (), Magick::OverCompositeOp);
+			}
+			catch (const std::exception &e)
+			{
+				errors[i] = e.what ();
+			}
+		}
+	};
+
+	jobs::Reservation reservation (paths.size ());
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < reservation.threads (); ++i)
+		workers.emplace_back (worker);
+
+	worker ();
+	for (auto &thread : workers)
+		thread.join ();
+
+	for (size_t i = 0; i < paths.size (); ++i)
+	{
+		if (!errors[i].empty ())
+			throw std::runtime_error (paths[i] + ": " + errors[i]);
+	}
+
+	output_width  = faces[0].columns ();
+	output_height = faces[0].rows ();
+	check_face_size (output_width, output_height);
+
+	std::vector<Magick::Image> result;
+	for (unsigned face = 0; face < faces.size (); ++face)
+	{
+		Magick::Image &img = faces[face];
+
+		// double-check RGB channels
+		if (!has_rgb (img))
+			throw std::runtime_error ("No RGB information");
+
+		if (img.columns () != output_width || img.rows () != output_height)
+			throw std::runtime_error ("Cubemap faces differ in size");
+
+		img.page (Magick::Geometry (img.columns (), img.rows ()));
+		result.emplace_back (orient_face (img, face));
+	}
+
+	return result;
+}
+
 /** @brief Load image
  *  @param[in] img Input image
  *  @returns vector of images to process
@@ -303,39 +530,7 @@ std::vector<Magick::Image> load_image (Magick::Image &img)
 		if (height != static_cast<size_t> (height))
 			throw std::runtime_error ("Invalid height");
 
-		// check for correct texture width
-		switch (static_cast<size_t> (width))
-		{
-		case 8:
-		case 16:
-		case 32:
-		case 64:
-		case 128:
-		case 256:
-		case 512:
-		case 1024:
-			break;
-
-		default:
-			throw std::runtime_error ("Invalid width");
-		}
-
-		// check for correct texture height
-		switch (static_cast<size_t> (height))
-		{
-		case 8:
-		case 16:
-		case 32:
-		case 64:
-		case 128:
-		case 256:
-		case 512:
-		case 1024:
-			break;
-
-		default:
-			throw std::runtime_error ("Invalid height");
-		}
+		check_face_size (width, height);
 	}
 	else
 	{
@@ -397,70 +592,23 @@ std::vector<Magick::Image> load_image (Magick::Image &img)
 	else
 	{
 		// extract the six faces from cubemap/skybox
-		// PICA 200 cubemapping inverts texture vertical axis
-		Magick::Image copy;
 		output_width  = width;
 		output_height = height;
 
-		// +x
-		copy = img;
-		copy.crop (Magick::Geometry (width, height, 2 * width, height));
-		if (process_mode == PROCESS_SKYBOX)
-			copy.flop (); // flip horizontal
-		copy.flip ();     // flip vertical
-		copy.comment ("px_");
-		result.emplace_back (copy);
-
-		// -x
-		copy = img;
-		copy.crop (Magick::Geometry (width, height, 0, height));
-		if (process_mode == PROCESS_SKYBOX)
-			copy.flop (); // flip horizontal
-		copy.flip ();     // flip vertical
-		copy.comment ("nx_");
-		result.emplace_back (copy);
-
-		// +y
-		copy = img;
-		copy.crop (Magick::Geometry (width, height, width, 0));
-		if (process_mode == PROCESS_CUBEMAP)
-			copy.flip (); // flip vertical
-		copy.comment ("py_");
-		result.emplace_back (copy);
-
-		// -y
-		copy = img;
-		copy.crop (Magick::Geometry (width, height, width, height * 2));
-		if (process_mode == PROCESS_CUBEMAP)
-			copy.flip (); // flip vertical
-		copy.comment ("ny_");
-		result.emplace_back (copy);
-
-		// +z
-		copy = img;
-		if (process_mode == PROCESS_CUBEMAP)
-			copy.crop (Magick::Geometry (width, height, width, height));
-		else
-		{
-			copy.crop (Magick::Geometry (width, height, width * 3, height));
-			copy.flop (); // flip horizontal
-		}
-		copy.flip (); // flip vertical
-		copy.comment ("pz_");
-		result.emplace_back (copy);
-
-		// -z
-		copy = img;
-		if (process_mode == PROCESS_CUBEMAP)
-			copy.crop (Magick::Geometry (width, height, width * 3, height));
-		else
+		// face positions in the cross, in px, nx, py, ny, pz, nz order
+		const size_t cubemap_cols[] = {2, 0, 1, 1, 1, 3};
+		const size_t skybox_cols[]  = {2, 0, 1, 1, 3, 1};
+		const size_t rows[]         = {1, 1, 0, 2, 1, 1};
+
+		for (unsigned face = 0; face < 6; ++face)
 		{
-			copy.crop (Magick::Geometry (width, height, width, height));
-			copy.flop (); // flip horizontal
+			const size_t col =
+			    process_mode == PROCESS_CUBEMAP ? cubemap_cols[face] : skybox_cols[face];
+
+			Magick::Image copy = img;
+			copy.crop (Magick::Geometry (width, height, col * width, rows[face] * height));
+			result.emplace_back (orient_face (copy, face));
 		}
-		copy.flip (); // flip vertical
-		copy.comment ("nz_");
-		result.emplace_back (copy);
 	}
 
 	return result;
@@ -508,6 +656,68 @@ std::string add_prefix (std::string path, std::string prefix)
 	return prefix + path;
 }
 
+/** @brief Add suffix to a file stem
+ *  @param[in] path   Path to suffix
+ *  @param[in] suffix Suffix to add before the file extension
+ *  @returns Path with suffixed file name
+ */
+std::string add_suffix (std::string path, std::string suffix)
+{
+	// look for the file extension
+	size_t slash = path.rfind ('/');
+	size_t pos   = path.rfind ('.');
+
+	// add suffix to file stem
+	if (pos != std::string::npos && (slash == std::string::npos || pos > slash))
+		return path.substr (0, pos) + suffix + path.substr (pos);
+	return path + suffix;
+}
+
+/** @brief Cut oversize image into a grid of textures
+ *  @param[in] img Input image
+ *  @returns vector of tiles to process, in row-major order
+ */
+std::vector<Magick::Image> load_tiles (Magick::Image &img)
+{
+	// Convert to RGBA once for all tiles
+	Magick::Image rgba (img.size (), transparent ());
+	rgba.composite (img, img.size (), Magick::OverCompositeOp);
+
+	// double-check RGB channels
+	if (!has_rgb (rgba))
+		throw std::runtime_error ("No RGB information");
+
+	const size_t width  = rgba.columns ();
+	const size_t height = rgba.rows ();
+
+	// full-size tiles, with the last row/column padded to a power of two
+	tile_cols = (width + max_image_width - 1) / max_image_width;
+	tile_rows = (height + max_image_height - 1) / max_image_height;
+
+	std::vector<Magick::Image> result;
+	for (size_t row = 0; row < tile_rows; ++row)
+	{
+		for (size_t col = 0; col < tile_cols; ++col)
+		{
+			Tile tile{};
+			tile.x      = col * max_image_width;
+			tile.y      = row * max_image_height;
+			tile.width  = std::min (max_image_width, width - tile.x);
+			tile.height = std::min (max_image_height, height - tile.y);
+
+			Magick::Image copy = rgba;
+			copy.crop (Magick::Geometry (tile.width, tile.height, tile.x, tile.y));
+			copy.page (Magick::Geometry (tile.width, tile.height));
+			copy.comment (std::to_string (tiles.size ()) + "_");
+
+			tiles.emplace_back (tile);
+			result.emplace_back (std::move (copy));
+		}
+	}
+
+	return result;
+}
+
 /** @brief Finalize process format
  *  @param[in] images Input images
  */
@@ -590,6 +800,47 @@ void work_thread (void *param)
 	}
 }
 
+/** @brief Work threads */
+std::vector<std::thread> workers;
+
+/** @brief Job tokens for the work threads */
+std::unique_ptr<jobs::Reservation> worker_tokens;
+
+/** @brief Start work threads if they are not running */
+void start_workers ()
+{
+	if (!workers.empty ())
+		return;
+
+	// under make, extra threads need job tokens
+	worker_tokens.reset (new jobs::Reservation (jobs::count ()));
+
+	work_done = false;
+	for (size_t i = 0; i < worker_tokens->threads (); ++i)
+		workers.emplace_back (work_thread, nullptr);
+}
+
+/** @brief Stop work threads */
+void stop_workers ()
+{
+	{
+		// no more work is coming
+		std::lock_guard<std::mutex> lock (work_mutex);
+		work_done = true;
+	}
+
+	work_cond.notify_all ();
+
+	// join all the worker threads
+	while (!workers.empty ())
+	{
+		workers.back ().join ();
+		workers.pop_back ();
+	}
+
+	worker_tokens.reset ();
+}
+
 /** @brief Process image
  *  @param[in] img Image to process
  */
@@ -598,65 +849,69 @@ void process_image (Magick::Image &img)
 	// get the image prefix
 	const std::string prefix = img.comment ();
 
-	void (*process) (encode::WorkUnit &) = nullptr;
+	encode::Processor process = nullptr;
+
+	// select the encoder specialized for the outputs being produced
+	const bool output_data    = !output_path.empty ();
+	const bool output_preview = !preview_path.empty ();
 
 	// get the processing routine
 	switch (process_format)
 	{
 	case RGBA8888:
-		process = encode::rgba8888;
+		process = encode::rgba8888 (output_data, output_preview);
 		break;
 
 	case RGB888:
-		process = encode::rgb888;
+		process = encode::rgb888 (output_data, output_preview);
 		break;
 
 	case RGBA5551:
-		process = encode::rgba5551;
+		process = encode::rgba5551 (output_data, output_preview);
 		break;
 
 	case RGB565:
-		process = encode::rgb565;
+		process = encode::rgb565 (output_data, output_preview);
 		break;
 
 	case RGBA4444:
-		process = encode::rgba4444;
+		process = encode::rgba4444 (output_data, output_preview);
 		break;
 
 	case LA88:
-		process = encode::la88;
+		process = encode::la88 (output_data, output_preview);
 		break;
 
 	case HILO88:
-		process = encode::hilo88;
+		process = encode::hilo88 (output_data, output_preview);
 		break;
 
 	case L8:
-		process = encode::l8;
+		process = encode::l8 (output_data, output_preview);
 		break;
 
 	case A8:
-		process = encode::a8;
+		process = encode::a8 (output_data, output_preview);
 		break;
 
 	case LA44:
-		process = encode::la44;
+		process = encode::la44 (output_data, output_preview);
 		break;
 
 	case L4:
-		process = encode::l4;
+		process = encode::l4 (output_data, output_preview);
 		break;
 
 	case A4:
-		process = encode::a4;
+		process = encode::a4 (output_data, output_preview);
 		break;
 
 	case ETC1:
-		process = encode::etc1;
+		process = encode::etc1 (output_data, output_preview);
 		break;
 
 	case ETC1A4:
-		process = encode::etc1a4;
+		process = encode::etc1a4 (output_data, output_preview);
 		break;
 
 	case AUTO_L8:
@@ -710,11 +965,11 @@ void process_image (Magick::Image &img)
 	// create the preview image
 	Magick::Image preview (Magick::Geometry (preview_width, preview_height), transparent ());
 
-	// create worker threads
-	std::vector<std::thread> workers;
-	work_done = false;
-	for (size_t i = 0; i < std::thread::hardware_concurrency (); ++i)
-		workers.emplace_back (work_thread, nullptr);
+	// keep ImageMagick from competing with the encoder threads
+	jobs::SerialMagick serial_magick;
+
+	// worker threads stay up across images
+	start_workers ();
 
 	size_t voff = 0; // vertical offset for mipmap preview
 	size_t hoff = 0; // horizontal offset for mipmap preview
@@ -752,8 +1007,9 @@ void process_image (Magick::Image &img)
 				    p + (j * width + i),
 				    width,
 				    etc1_quality,
-				    !output_path.empty (),
-				    !preview_path.empty (),
+				    etc1_fast,
+				    etc1_error_target,
+				    etc1_cache.get (),
 				    process);
 
 				{
@@ -766,17 +1022,6 @@ void process_image (Magick::Image &img)
 			}
 		}
 
-		if (img_queue.empty ())
-		{
-			{
-				// no more work is coming
-				std::lock_guard<std::mutex> lock (work_mutex);
-				work_done = true;
-			}
-
-			work_cond.notify_all ();
-		}
-
 		// gather results
 		for (uint64_t num_result = 0; num_result < num_work; ++num_result)
 		{
@@ -818,34 +1063,9 @@ void process_image (Magick::Image &img)
 		}
 	}
 
-	// join all the worker threads
-	while (!workers.empty ())
-	{
-		workers.back ().join ();
-		workers.pop_back ();
-	}
-
+	// output the preview image in the background
 	if (!preview_path.empty ())
-	{
-		try
-		{
-			// output the preview image
-			preview.write (add_prefix (preview_path, prefix));
-		}
-		catch (...)
-		{
-			try
-			{
-				// type couldn't be determined from file extension, so try png
-				preview.magick ("PNG");
-				preview.write (add_prefix (preview_path, prefix));
-			}
-			catch (...)
-			{
-				std::fprintf (stderr, "Failed to output preview\n");
-			}
-		}
-	}
+		preview::write (preview, add_prefix (preview_path, prefix));
 }
 
 /** @brief Write buffer
@@ -1033,7 +1253,12 @@ void write_image_data (FILE *fp)
 	}
 
 	// compress data
-	std::vector<uint8_t> buffer = compress (image_data.data (), image_data.size ());
+	std::vector<uint8_t> buffer;
+	{
+		stats::ScopedTimer timer ("compress");
+		buffer = compress (image_data.data (), image_data.size ());
+	}
+
 	if (buffer.empty ())
 	{
 		std::fclose (fp);
@@ -1041,9 +1266,21 @@ void write_image_data (FILE *fp)
 	}
 
 	// output data
+	stats::ScopedTimer timer ("write");
 	write_buffer (fp, buffer.data (), buffer.size ());
 }
 
+/** @brief Write texture
+ *  @param[in] fp File handle
+ */
+void write_texture (FILE *fp)
+{
+	if (!output_raw)
+		write_tex3ds_header (fp);
+
+	write_image_data (fp);
+}
+
 /** @brief Write output data
  */
 void write_output_data ()
@@ -1056,15 +1293,78 @@ void write_output_data ()
 	if (!fp)
 		throw std::runtime_error ("Failed to open output file");
 
-	if (!output_raw)
-		write_tex3ds_header (fp);
-
-	write_image_data (fp);
+	write_texture (fp);
 
 	// close output file
 	std::fclose (fp);
 }
 
+/** @brief Process and output tiles
+ *  @param[in] images Tiles from load_tiles()
+ */
+void process_tiles (std::vector<Magick::Image> &images)
+{
+	assert (images.size () == tiles.size ());
+
+	FILE *bundle = nullptr;
+	if (tile_mode == TILE_BUNDLE && !output_path.empty ())
+	{
+		bundle = std::fopen (output_path.c_str (), "wb");
+		if (!bundle)
+			throw std::runtime_error ("Failed to open output file");
+	}
+
+	for (size_t i = 0; i < images.size (); ++i)
+	{
+		Tile &tile = tiles[i];
+
+		// each tile is a separate texture
+		subimage_data.clear ();
+		image_data.clear ();
+
+		const std::string prefix = images[i].comment ();
+
+		std::vector<Magick::Image> texture = load_image (images[i]);
+		assert (texture.size () == 1);
+
+		texture[0].comment (prefix);
+		process_image (texture[0]);
+
+		tile.tex_width  = output_width;
+		tile.tex_height = output_height;
+
+		if (output_path.empty ())
+			continue;
+
+		if (bundle)
+		{
+			// keep each texture 4-byte aligned in the bundle
+			static const uint8_t padding[4] = {};
+
+			tile.offset = std::ftell (bundle);
+			write_texture (bundle);
+			tile.size = std::ftell (bundle) - tile.offset;
+
+			write_buffer (bundle, padding, -tile.size & 0x3);
+			continue;
+		}
+
+		tile.path = add_suffix (output_path, "_" + std::to_string (i));
+
+		FILE *fp = std::fopen (tile.path.c_str (), "wb");
+		if (!fp)
+			throw std::runtime_error ("Failed to open output file");
+
+		write_texture (fp);
+
+		// close output file
+		std::fclose (fp);
+	}
+
+	if (bundle)
+		std::fclose (bundle);
+}
+
 /** @brief Sanitize identifier
  */
 void sanitize_identifier (std::string &id)
@@ -1080,6 +1380,36 @@ void sanitize_identifier (std::string &id)
 	}
 }
 
+/** @brief Quote a string as a C string literal
+ *  @param[in] str String to quote
+ *  @returns string literal, including the quotes
+ */
+std::string c_string_literal (const std::string &str)
+{
+	std::string literal = "\"";
+	for (const auto &c : str)
+	{
+		const unsigned char byte = c;
+		if (byte == '"' || byte == '\\' || byte == '?')
+		{
+			// '?' would otherwise start trigraphs
+			literal += '\\';
+			literal += c;
+		}
+		else if (byte < 0x20 || byte >= 0x7F)
+		{
+			// octal escapes stop after three digits, unlike hex escapes
+			char escape[5];
+			std::snprintf (escape, sizeof (escape), "\\%03o", byte);
+			literal += escape;
+		}
+		else
+			literal += c;
+	}
+
+	return literal + '"';
+}
+
 /** @brief Write dependency file
  */
 void write_dependency ()
@@ -1099,13 +1429,24 @@ void write_dependency ()
 		return;
 	}
 
+	std::string outputs = output_path;
+	if (tile_mode == TILE_FILES && !output_path.empty ())
+	{
+		outputs.clear ();
+		for (const auto &tile : tiles)
+			outputs += (outputs.empty () ? "" : " ") + tile.path;
+	}
+
 	std::string target;
 	if (output_path.empty ())
 		target = header_path;
 	else if (header_path.empty ())
-		target = output_path;
+		target = outputs;
 	else
-		target = output_path + ' ' + header_path;
+		target = outputs + ' ' + header_path;
+
+	if (!lookup_path.empty ())
+		target += ' ' + lookup_path;
 
 	std::fprintf (fp, "%s:", target.c_str ());
 	for (const auto &dependency : dependencies)
@@ -1142,6 +1483,47 @@ void write_header ()
 
 	sanitize_identifier (header_path);
 
+	if (tile_mode != TILE_NONE)
+	{
+		const Tile &last = tiles.back ();
+
+		std::fprintf (fp, "#define %s_width %zu\n", header_path.c_str (), last.x + last.width);
+		std::fprintf (fp, "#define %s_height %zu\n", header_path.c_str (), last.y + last.height);
+		std::fprintf (fp, "#define %s_tile_cols %zu\n", header_path.c_str (), tile_cols);
+		std::fprintf (fp, "#define %s_tile_rows %zu\n", header_path.c_str (), tile_rows);
+		std::fprintf (fp, "#define %s_tile_count %zu\n\n", header_path.c_str (), tiles.size ());
+
+		// tiles are numbered in row-major order
+		std::fprintf (fp, "/* x, y, width, height in the image; texture width, height */\n");
+		std::fprintf (fp, "static const unsigned short %s_tiles[][6] = {\n", header_path.c_str ());
+		for (const auto &tile : tiles)
+		{
+			std::fprintf (fp,
+			    "\t{ %zu, %zu, %zu, %zu, %zu, %zu },\n",
+			    tile.x,
+			    tile.y,
+			    tile.width,
+			    tile.height,
+			    tile.tex_width,
+			    tile.tex_height);
+		}
+		std::fprintf (fp, "};\n");
+
+		if (tile_mode == TILE_BUNDLE)
+		{
+			std::fprintf (fp, "\n/* offset, size of each texture in the bundle */\n");
+			std::fprintf (
+			    fp, "static const unsigned long %s_tile_offsets[][2] = {\n", header_path.c_str ());
+			for (const auto &tile : tiles)
+				std::fprintf (fp, "\t{ %zu, %zu },\n", tile.offset, tile.size);
+			std::fprintf (fp, "};\n");
+		}
+
+		// close output header
+		std::fclose (fp);
+		return;
+	}
+
 	size_t i = 0;
 	for (const auto &sub : subimage_data)
 	{
@@ -1171,14 +1553,212 @@ void write_header ()
 	std::fclose (fp);
 }
 
-/** @brief Print version information */
-void print_version ()
+/** @brief Write sub-image lookup
+ *
+ *  Emits a self-contained C header with a minimal perfect hash from sub-image
+ *  name (file name without extension) to sub-image index and texture
+ *  coordinates.
+ */
+void write_lookup ()
 {
-	std::printf ("tex3ds v" PACKAGE_VERSION "\n"
-	             "Copyright (c) 2017-2021 Michael Theall (mtheall)\n\n"
+	// check if we need to output the lookup
+	if (lookup_path.empty ())
+		return;
 
-	             "tex3ds is free software: you can redistribute it and/or modify\n"
-	             "it under the terms of the GNU General Public License as published by\n"
+	std::vector<std::string> keys;
+	std::vector<size_t> subs;
+	for (size_t i = 0; i < subimage_data.size (); ++i)
+	{
+		const auto &sub = subimage_data[i];
+		if (sub.name.empty ())
+			continue;
+
+		std::string key = sub.name;
+
+		auto pos = key.rfind ('.');
+		if (pos != std::string::npos)
+			key.resize (pos);
+
+		if (std::find (std::begin (keys), std::end (keys), key) != std::end (keys))
+			throw std::runtime_error ("Duplicate sub-image name '" + key + "'");
+
+		keys.emplace_back (std::move (key));
+		subs.emplace_back (i);
+	}
+
+	if (keys.empty ())
+		throw std::runtime_error ("No named sub-images for lookup");
+
+	std::vector<int32_t> displace;
+	std::vector<size_t> slots;
+	if (!phf::build (keys, displace, slots))
+		throw std::runtime_error ("Failed to build sub-image lookup");
+
+	FILE *fp = std::fopen (lookup_path.c_str (), "w");
+	if (!fp)
+		throw std::runtime_error ("Failed to open output lookup");
+
+	std::string id;
+	{
+		std::vector<char> path (lookup_path.begin (), lookup_path.end ());
+		path.emplace_back (0);
+		id = ::basename (path.data ());
+	}
+
+	auto pos = id.rfind ('.');
+	if (pos != std::string::npos)
+		id.resize (pos);
+
+	sanitize_identifier (id);
+
+	const char *name = id.c_str ();
+	const size_t n   = keys.size ();
+
+	std::fprintf (fp, "/* Generated by tex3ds */\n");
+	std::fprintf (fp, "#pragma once\n\n");
+	std::fprintf (fp, "#include <stddef.h>\n");
+	std::fprintf (fp, "#include <stdint.h>\n");
+	std::fprintf (fp, "#include <string.h>\n\n");
+
+	std::fprintf (fp,
+	    "typedef struct\n"
+	    "{\n"
+	    "\tconst char *name;\n"
+	    "\tuint16_t index;\n"
+	    "\tuint16_t width;\n"
+	    "\tuint16_t height;\n"
+	    "\tfloat left;\n"
+	    "\tfloat top;\n"
+	    "\tfloat right;\n"
+	    "\tfloat bottom;\n"
+	    "} %s_subimage;\n\n",
+	    name);
+
+	std::fprintf (fp, "static const int32_t %s_displace[%zu] = {\n", name, n);
+	for (const auto &d : displace)
+		std::fprintf (fp, "\t%d,\n", d);
+	std::fprintf (fp, "};\n\n");
+
+	std::fprintf (fp, "static const %s_subimage %s_subimages[%zu] = {\n", name, name, n);
+	for (const auto &slot : slots)
+	{
+		const auto &sub = subimage_data[subs[slot]];
+
+		// same dimensions as write_tex3ds_header
+		uint16_t width;
+		uint16_t height;
+		if (sub.rotated)
+		{
+			height = (sub.bottom - sub.top) * output_width;
+			width  = (sub.right - sub.left) * output_height;
+		}
+		else
+		{
+			width  = (sub.right - sub.left) * output_width;
+			height = (sub.top - sub.bottom) * output_height;
+		}
+
+		std::fprintf (fp,
+		    "\t{ %s, %zu, %u, %u, %.9gf, %.9gf, %.9gf, %.9gf },\n",
+		    c_string_literal (keys[slot]).c_str (),
+		    subs[slot],
+		    width,
+		    height,
+		    sub.left,
+		    sub.top,
+		    sub.right,
+		    sub.bottom);
+	}
+	std::fprintf (fp, "};\n\n");
+
+	// must match phf::hash
+	std::fprintf (fp,
+	    "static inline uint32_t %s_hash (uint32_t seed, const char *key)\n"
+	    "{\n"
+	    "\tuint32_t h = 0x811C9DC5u ^ seed;\n"
+	    "\twhile (*key)\n"
+	    "\t{\n"
+	    "\t\th ^= (unsigned char)*key++;\n"
+	    "\t\th *= 0x01000193u;\n"
+	    "\t}\n\n"
+	    "\treturn h;\n"
+	    "}\n\n",
+	    name);
+
+	std::fprintf (fp,
+	    "/* Find a sub-image by name; returns NULL if there is no such sub-image */\n"
+	    "static inline const %s_subimage *%s_lookup (const char *key)\n"
+	    "{\n"
+	    "\tconst int32_t d = %s_displace[%s_hash (0, key) %% %zuu];\n"
+	    "\tconst uint32_t slot =\n"
+	    "\t    d < 0 ? (uint32_t)(-d - 1) : %s_hash ((uint32_t)d, key) %% %zuu;\n\n"
+	    "\tif (strcmp (%s_subimages[slot].name, key) != 0)\n"
+	    "\t\treturn NULL;\n\n"
+	    "\treturn &%s_subimages[slot];\n"
+	    "}\n",
+	    name,
+	    name,
+	    name,
+	    name,
+	    n,
+	    name,
+	    n,
+	    name,
+	    name);
+
+	// close output lookup
+	std::fclose (fp);
+}
+
+/** @brief Print PSNR for accumulated ETC1 squared error
+ *  @param[in] label Label to print
+ *  @param[in] error Squared error counter name
+ */
+void print_psnr (const char *label, const char *error)
+{
+	const uint64_t samples = stats::getCount ("etc1 blocks") * 4 * 4 * 3;
+	const uint64_t sse     = stats::getCount (error);
+
+	if (sse == 0)
+		std::printf ("  %-28s %12s\n", label, "inf");
+	else
+		std::printf ("  %-28s %12.3f dB\n",
+		    label,
+		    10.0 * std::log10 (255.0 * 255.0 * samples / static_cast<double> (sse)));
+}
+
+/** @brief Print statistics */
+void print_stats ()
+{
+	if (!stats::enabled)
+		return;
+
+	if (etc1_cache)
+	{
+		stats::addCount ("etc1 cache hits", etc1_cache->hits ());
+		stats::addCount ("etc1 cache misses", etc1_cache->misses ());
+	}
+
+	std::printf ("Statistics:\n");
+	stats::print (stdout);
+	stats::printAllocations (stdout);
+
+	if (stats::getCount ("etc1 blocks") != 0)
+	{
+		print_psnr ("etc1 psnr", "etc1 squared error");
+		if (etc1_fast)
+			print_psnr ("etc1 psnr (rg_etc1 low)", "etc1 reference squared error");
+	}
+}
+
+/** @brief Print version information */
+void print_version ()
+{
+	std::printf ("tex3ds v" PACKAGE_VERSION "\n"
+	             "Copyright (c) 2017-2021 Michael Theall (mtheall)\n\n"
+
+	             "tex3ds is free software: you can redistribute it and/or modify\n"
+	             "it under the terms of the GNU General Public License as published by\n"
 	             "the Free Software Foundation, either version 3 of the License, or\n"
 	             "(at your option) any later version.\n\n"
 
@@ -1205,10 +1785,13 @@ void print_usage (const char *prog)
 	    "    -H, --header <file>          Output C header to file\n"
 	    "    -h, --help                   Show this help message\n"
 	    "    -i, --include <file>         Include options from file\n"
+	    "    -j, --jobs <n>               Number of threads, shared with ImageMagick\n"
+	    "                                 (default: number of hardware threads)\n"
 	    "    -m, --mipmap <filter>        Generate mipmaps. See \"Mipmap Filter Options\"\n"
 	    "    -o, --output <output>        Output file\n"
 	    "    -p, --preview <preview>      Output preview file\n"
-	    "    -q, --quality <etc1-quality> ETC1 quality. Valid options: low, medium (default), high\n"
+	    "    -q, --quality <etc1-quality> ETC1 quality. Valid options: fastest, low, medium (default), "
+	    "high\n"
 	    "    -r, --raw                    Output image data only\n"
 	    "    -t, --trim                   Trim input image(s)\n"
 	    "    -v, --version                Show version and copyright information\n"
@@ -1217,6 +1800,23 @@ void print_usage (const char *prog)
 	    "    -c, --cubemap                Generate a cubemap. See \"Cubemap\"\n"
 	    "    -s, --skybox                 Generate a skybox. See \"Skybox\"\n"
 	    "    -b, --border <border-type>   Inserts a border around each image. See \"Border Options\"\n"
+	    "    --etc1-cache <file>          Reuse ETC1 blocks from (and add them to) a cache file\n"
+	    "    --etc1-cache-size <MiB>      Size of a newly created ETC1 cache file (default 64)\n"
+	    "    --etc1-error-target <error>  Stop ETC1 search once a block's squared error is at most\n"
+	    "                                 <error> (0-65535, default 0 = off)\n"
+	    "    --stats                      Print stage timings and ETC1 error statistics\n"
+	    "    --memory-limit <MiB>         Limit ImageMagick pixel cache memory; the rest goes to disk\n"
+	    "    --lookup <file>              Output C header with a perfect-hash sub-image name lookup\n"
+	    "    --tile <mode>                Cut an oversize input into 1024x1024 textures. Valid\n"
+	    "                                 options: files (numbered outputs), bundle (one output)\n"
+	    "    --input-cache <dir>          Reuse decoded input pixels from (and add them to) a cache\n"
+	    "                                 directory\n"
+	    "    --watch <manifest>           Run each line of manifest as a conversion, then rerun\n"
+	    "                                 conversions whose inputs or -i files change\n"
+	    "    --batch <manifest>           Run each line of manifest as a conversion in its own\n"
+	    "                                 process, several at once. See \"Batch\"\n"
+	    "    --memory-budget <MiB>        Only run batch conversions together while their\n"
+	    "                                 estimated peak memory fits\n"
 	    "    <input>                      Input file\n\n"
 
 	    "  Format Options:\n"
@@ -1311,7 +1911,8 @@ void print_usage (const char *prog)
 	    "    | -X | +Z | +X | -Z |\n"
 	    "    +----+----+----+----+\n"
 	    "    |    | -Y |         |\n"
-	    "    +----+----+---------+\n\n"
+	    "    +----+----+---------+\n"
+	    "    Alternatively, six face images may be given in +X -X +Y -Y +Z -Z order.\n\n"
 
 	    "  Skybox:\n"
 	    "    A skybox is generated from the input image in the following convention:\n"
@@ -1321,9 +1922,26 @@ void print_usage (const char *prog)
 	    "    | -X | -Z | +X | +Z |\n"
 	    "    +----+----+----+----+\n"
 	    "    |    | -Y |         |\n"
-	    "    +----+----+---------+\n\n");
+	    "    +----+----+---------+\n"
+	    "    Alternatively, six face images may be given in +X -X +Y -Y +Z -Z order.\n\n");
 }
 
+/** @brief Long-only option values */
+enum LongOption
+{
+	OPT_ETC1_CACHE = 0x100, ///< --etc1-cache
+	OPT_ETC1_CACHE_SIZE,    ///< --etc1-cache-size
+	OPT_ETC1_ERROR_TARGET,  ///< --etc1-error-target
+	OPT_STATS,              ///< --stats
+	OPT_TILE,               ///< --tile
+	OPT_LOOKUP,             ///< --lookup
+	OPT_MEMORY_LIMIT,       ///< --memory-limit
+	OPT_WATCH,              ///< --watch
+	OPT_INPUT_CACHE,        ///< --input-cache
+	OPT_BATCH,              ///< --batch
+	OPT_MEMORY_BUDGET,      ///< --memory-budget
+};
+
 /** @brief Program long options */
 const struct option long_options[] = {
     /* clang-format off */
@@ -1335,6 +1953,7 @@ const struct option long_options[] = {
 	{ "header",   required_argument, nullptr, 'H', },
 	{ "help",     no_argument,       nullptr, 'h', },
 	{ "include",  required_argument, nullptr, 'i', },
+	{ "jobs",     required_argument, nullptr, 'j', },
 	{ "mipmap",   required_argument, nullptr, 'm', },
 	{ "output",   required_argument, nullptr, 'o', },
 	{ "preview",  required_argument, nullptr, 'p', },
@@ -1344,6 +1963,17 @@ const struct option long_options[] = {
 	{ "trim",     no_argument,       nullptr, 't', },
 	{ "version",  no_argument,       nullptr, 'v', },
 	{ "compress", required_argument, nullptr, 'z', },
+	{ "etc1-cache",        required_argument, nullptr, OPT_ETC1_CACHE,        },
+	{ "etc1-cache-size",   required_argument, nullptr, OPT_ETC1_CACHE_SIZE,   },
+	{ "etc1-error-target", required_argument, nullptr, OPT_ETC1_ERROR_TARGET, },
+	{ "stats",             no_argument,       nullptr, OPT_STATS,             },
+	{ "tile",              required_argument, nullptr, OPT_TILE,              },
+	{ "lookup",            required_argument, nullptr, OPT_LOOKUP,            },
+	{ "memory-limit",      required_argument, nullptr, OPT_MEMORY_LIMIT,      },
+	{ "watch",             required_argument, nullptr, OPT_WATCH,             },
+	{ "input-cache",       required_argument, nullptr, OPT_INPUT_CACHE,       },
+	{ "batch",             required_argument, nullptr, OPT_BATCH,             },
+	{ "memory-budget",     required_argument, nullptr, OPT_MEMORY_BUDGET,     },
 	{ nullptr,    no_argument,       nullptr,   0, },
 	/* clang-format off */
 };
@@ -1391,62 +2021,83 @@ std::string getPath (std::string path)
 	return acc;
 }
 
-std::vector<std::string> readOptions (const std::string &path)
+/** @brief Split options text into arguments
+ *  @param[in] text Options text
+ *  @returns arguments, preceded by an empty program name
+ */
+std::vector<std::string> splitOptions (const std::string &text)
 {
-	FILE *fp = std::fopen (path.c_str (), "r");
-	if (!fp)
-		throw std::runtime_error ("Failed to open options file");
+	std::vector<std::string> options (1);
+	bool quoted = false;
+	std::string opt;
 
-	try
+	for (size_t i = 0; i < text.size (); ++i)
 	{
-		std::vector<std::string> options (1);
-		int c;
-		bool quoted = false;
-		std::string opt;
-
-		while ((c = std::fgetc (fp)) != EOF)
+		int c = static_cast<unsigned char> (text[i]);
+		switch (c)
 		{
-			switch (c)
+		case '"':
+			quoted = !quoted;
+			break;
+
+		case '\\':
+			if (quoted)
+				c = ++i < text.size () ? static_cast<unsigned char> (text[i]) : EOF;
+			if (c == EOF)
+				throw std::runtime_error (
+				    "Reached end of options file at partially escaped character");
+
+		/* fall-through */
+		default:
+			if (quoted)
+				opt.push_back (c);
+			else if (std::isspace (c))
 			{
-			case '"':
-				quoted = !quoted;
-				break;
-
-			case '\\':
-				if (quoted)
-					c = std::fgetc (fp);
-				if (c == EOF)
-					throw std::runtime_error (
-					    "Reached end of options file at partially escaped character");
-
-			/* fall-through */
-			default:
-				if (quoted)
-					opt.push_back (c);
-				else if (std::isspace (c))
-				{
-					if (!opt.empty ())
-						options.emplace_back (std::move (opt));
-				}
-				else
-					opt.push_back (c);
-				break;
+				if (!opt.empty ())
+					options.emplace_back (std::move (opt));
 			}
+			else
+				opt.push_back (c);
+			break;
 		}
+	}
 
-		if (quoted)
-			throw std::runtime_error ("Reached end of options file at partially quoted string");
+	if (quoted)
+		throw std::runtime_error ("Reached end of options file at partially quoted string");
 
-		if (!opt.empty ())
-			options.emplace_back (opt);
+	if (!opt.empty ())
+		options.emplace_back (opt);
 
-		return options;
-	}
-	catch (...)
-	{
-		std::fclose (fp);
-		throw;
-	}
+	return options;
+}
+
+/** @brief Read text file
+ *  @param[in] path Path to read
+ *  @returns file contents
+ */
+std::string readText (const std::string &path)
+{
+	FILE *fp = std::fopen (path.c_str (), "r");
+	if (!fp)
+		throw std::runtime_error ("Failed to open options file");
+
+	std::string text;
+	char buffer[4096];
+	size_t rc;
+	while ((rc = std::fread (buffer, 1, sizeof (buffer), fp)) > 0)
+		text.append (buffer, rc);
+
+	const bool failed = std::ferror (fp);
+	std::fclose (fp);
+	if (failed)
+		throw std::runtime_error ("Failed to read options file");
+
+	return text;
+}
+
+std::vector<std::string> readOptions (const std::string &path)
+{
+	return splitOptions (readText (path));
 }
 
 ParseStatus parseOptions (std::vector<char *> &args)
@@ -1456,7 +2107,7 @@ ParseStatus parseOptions (std::vector<char *> &args)
 	// parse options
 	while (
 	    (c = ::getopt_long (
-	         args.size (), args.data (), "d:f:H:hi:m:o:p:q:rs:tvz:", long_options, nullptr)) != -1)
+	         args.size (), args.data (), "d:f:H:hi:j:m:o:p:q:rs:tvz:", long_options, nullptr)) != -1)
 	{
 		switch (c)
 		{
@@ -1532,10 +2183,20 @@ ParseStatus parseOptions (std::vector<char *> &args)
 			print_usage (prog);
 			return PARSE_EXIT;
 
+		case 'j':
+			// set thread budget
+			if (!jobs::parseCount (optarg, jobs_count))
+			{
+				std::fprintf (stderr, "Invalid number of jobs '%s'\n", optarg);
+				return PARSE_FAILURE;
+			}
+			break;
+
 		case 'i':
 			try
 			{
 				std::string optionsFile = getPath (optarg);
+				include_files.emplace_back (optionsFile);
 				std::string new_cwd;
 				{
 					std::vector<char> path (optionsFile.begin (), optionsFile.end ());
@@ -1603,7 +2264,14 @@ ParseStatus parseOptions (std::vector<char *> &args)
 
 		case 'q':
 			// set ETC1 quality
-			if (strcasecmp ("low", optarg) == 0)
+			etc1_fast = false;
+			if (strcasecmp ("fastest", optarg) == 0)
+			{
+				// rg_etc1 low quality is the reference for --stats
+				etc1_fast    = true;
+				etc1_quality = rg_etc1::cLowQuality;
+			}
+			else if (strcasecmp ("low", optarg) == 0)
 				etc1_quality = rg_etc1::cLowQuality;
 			else if (strcasecmp ("medium", optarg) == 0 || strcasecmp ("med", optarg) == 0)
 				etc1_quality = rg_etc1::cMediumQuality;
@@ -1656,6 +2324,99 @@ ParseStatus parseOptions (std::vector<char *> &args)
 			break;
 		}
 
+		case OPT_ETC1_CACHE:
+			// set ETC1 cache path option
+			etc1_cache_path = getPath (optarg);
+			break;
+
+		case OPT_ETC1_CACHE_SIZE:
+		{
+			// set ETC1 cache size option
+			char *end;
+			errno               = 0;
+			unsigned long value = std::strtoul (optarg, &end, 10);
+			if (errno || *end || value == 0 || value > 65536)
+			{
+				std::fprintf (stderr, "Invalid ETC1 cache size '%s'\n", optarg);
+				return PARSE_FAILURE;
+			}
+
+			etc1_cache_size = value;
+			break;
+		}
+
+		case OPT_ETC1_ERROR_TARGET:
+		{
+			// set ETC1 error target option
+			char *end;
+			errno               = 0;
+			unsigned long value = std::strtoul (optarg, &end, 10);
+			if (errno || *end || value > 0xFFFF)
+			{
+				std::fprintf (stderr, "Invalid ETC1 error target '%s'\n", optarg);
+				return PARSE_FAILURE;
+			}
+
+			etc1_error_target = value;
+			break;
+		}
+
+		case OPT_STATS:
+			// collect statistics
+			stats::enabled = true;
+			break;
+
+		case OPT_MEMORY_LIMIT:
+			// set ImageMagick memory limit
+			if (!jobs::parseMemoryLimit (optarg, memory_limit))
+			{
+				std::fprintf (stderr, "Invalid memory limit '%s'\n", optarg);
+				return PARSE_FAILURE;
+			}
+			break;
+
+		case OPT_LOOKUP:
+			// set sub-image lookup path option
+			lookup_path = getPath (optarg);
+			break;
+
+		case OPT_WATCH:
+			// set watch manifest path option
+			watch_path = getPath (optarg);
+			break;
+
+		case OPT_INPUT_CACHE:
+			// set decoded input cache directory option
+			input_cache_path = getPath (optarg);
+			break;
+
+		case OPT_BATCH:
+			// set batch manifest path option
+			batch_path = getPath (optarg);
+			break;
+
+		case OPT_MEMORY_BUDGET:
+			// set batch memory budget
+			if (!jobs::parseMemoryLimit (optarg, memory_budget))
+			{
+				std::fprintf (stderr, "Invalid memory budget '%s'\n", optarg);
+				return PARSE_FAILURE;
+			}
+			break;
+
+		case OPT_TILE:
+			// set tile output mode
+			if (strcasecmp (optarg, "files") == 0)
+				tile_mode = TILE_FILES;
+			else if (strcasecmp (optarg, "bundle") == 0)
+				tile_mode = TILE_BUNDLE;
+			else
+			{
+				std::fprintf (stderr, "Invalid tile option '%s'\n", optarg);
+				return PARSE_FAILURE;
+			}
+			break;
+
 		default:
 			std::fprintf (stderr, "Invalid option '%c'\n", optopt);
 			return PARSE_FAILURE;
@@ -1671,6 +2432,13 @@ ParseStatus parseOptions (std::vector<char *> &args)
 		return PARSE_FAILURE;
 	}
 
+	if (tile_mode != TILE_NONE && (process_mode != PROCESS_NORMAL || border || edge))
+	{
+		std::fprintf (
+		    stderr, "--tile cannot be combined with --atlas, --cubemap, --skybox or --border\n");
+		return PARSE_FAILURE;
+	}
+
 	while (static_cast<size_t> (optind) < args.size ())
 	{
 		std::string path = getPath (args[optind++]);
@@ -1680,34 +2448,12 @@ ParseStatus parseOptions (std::vector<char *> &args)
 
 	return PARSE_SUCCESS;
 }
-}
-
-/** @brief Program entry point
- *  @param[in] argc Number of command-line arguments
- *  @param[in] argv Command-line arguments
+/** @brief Convert the inputs given by the current options
  *  @retval EXIT_SUCCESS
  *  @retval EXIT_FAILURE
  */
-int main (int argc, char *argv[])
+int convert ()
 {
-	prog = argv[0];
-
-	std::setvbuf (stdout, nullptr, _IOLBF, 0);
-	std::setvbuf (stderr, nullptr, _IOLBF, 0);
-
-	std::vector<char *> args (argv, argv + argc);
-
-	// parse options
-	switch (parseOptions (args))
-	{
-	case PARSE_SUCCESS:
-		break;
-	case PARSE_FAILURE:
-		return EXIT_FAILURE;
-	case PARSE_EXIT:
-		return EXIT_SUCCESS;
-	}
-
 	// check that input file(s) were provided
 	if (input_files.empty ())
 	{
@@ -1715,53 +2461,108 @@ int main (int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	// use the on-disk decoded input cache; an earlier watched conversion may have set one
+	if (!input_cache::setDirectory (input_cache_path))
+		return EXIT_FAILURE;
+
 	// initialize rg_etc1 if ETC1/ETC1A format chosen
 	if (process_format == ETC1 || process_format == ETC1A4 || process_format == AUTO_ETC1)
-		rg_etc1::pack_etc1_block_init ();
-
-	try
 	{
-		std::vector<Magick::Image> images;
-		if (process_mode == PROCESS_ATLAS)
+		if (!etc1_initialized)
 		{
-			Atlas atlas (Atlas::build (input_files, trim, border, edge));
-			subimage_data.swap (atlas.subs);
-
-			images = load_image (atlas.img);
+			rg_etc1::pack_etc1_block_init ();
+			etc1_initialized = true;
 		}
-		else if (input_files.size () > 1)
+
+		// a warm process keeps the cache open while the path stays the same
+		if (etc1_cache_path.empty ())
+			etc1_cache.reset ();
+		else if (!etc1_cache || etc1_cache_open_path != etc1_cache_path)
 		{
-			std::fprintf (stderr, "Multiple inputs only supported with atlas mode\n");
-			return EXIT_FAILURE;
+			etc1_cache.reset (new ETC1Cache (etc1_cache_path, etc1_cache_size << 20));
+			etc1_cache_open_path = etc1_cache_path;
 		}
-		else
+	}
+
+	try
+	{
+		std::vector<Magick::Image> images;
+
 		{
-			Magick::Image img (input_files[0]);
+			stats::ScopedTimer timer ("load");
+
+			if (process_mode == PROCESS_ATLAS)
+			{
+				Atlas atlas (Atlas::build (input_files, trim, border, edge));
+				subimage_data.swap (atlas.subs);
+
+				images = load_image (atlas.img);
+			}
+			else if ((process_mode == PROCESS_CUBEMAP || process_mode == PROCESS_SKYBOX) &&
+			         input_files.size () == 6)
+				images = load_faces (input_files);
+			else if (input_files.size () > 1)
+			{
+				std::fprintf (stderr,
+				    "Multiple inputs only supported with atlas mode or six cubemap/skybox faces\n");
+				return EXIT_FAILURE;
+			}
+			else
+			{
+				Magick::Image img = input_cache::image (input_files[0]);
 
-			if (trim)
-				img = applyTrim (img);
+				if (trim)
+					img = applyTrim (img);
 
-			if (edge)
-				applyEdge (img);
+				if (edge)
+					applyEdge (img);
 
-			images = load_image (img);
+				images = tile_mode != TILE_NONE ? load_tiles (img) : load_image (img);
+			}
 		}
 
 		// finalize process format
 		finalize_process_format (images);
 
-		// process each sub-image
-		for (size_t i = 0; i < images.size (); ++i)
-			process_image (images[i]);
+		{
+			stats::ScopedTimer timer ("encode");
+
+			// process each sub-image; tiles are output as they are processed
+			if (tile_mode != TILE_NONE)
+				process_tiles (images);
+			else
+			{
+				for (size_t i = 0; i < images.size (); ++i)
+					process_image (images[i]);
+			}
+		}
 
 		// write output data
-		write_output_data ();
+		if (tile_mode == TILE_NONE)
+			write_output_data ();
+
+		// merge new blocks into the ETC1 cache
+		if (etc1_cache)
+			etc1_cache->flush ();
 
 		// write dependency file
 		write_dependency ();
 
 		// write header
 		write_header ();
+
+		// write sub-image lookup
+		write_lookup ();
+
+		{
+			stats::ScopedTimer timer ("preview");
+
+			// finish writing previews
+			preview::wait ();
+		}
+
+		// print statistics
+		print_stats ();
 	}
 	catch (const std::exception &e)
 	{
@@ -1775,3 +2576,507 @@ int main (int argc, char *argv[])
 
 	return EXIT_SUCCESS;
 }
+
+/** @brief Time to let a burst of file changes settle before converting (ms) */
+#define WATCH_SETTLE_MS 100
+
+/** @brief Conversion from a watch manifest */
+struct Conversion
+{
+	std::vector<std::string> args; ///< Options, preceded by an empty program name
+	std::set<std::string> watched; ///< Canonical paths of inputs and options files
+};
+
+/** @brief Reset options between conversions */
+void reset_options ()
+{
+	include_stack.assign (1, std::string ());
+	include_files.clear ();
+	input_files.clear ();
+	depends_path.clear ();
+	dependencies.clear ();
+	header_path.clear ();
+	output_path.clear ();
+	lookup_path.clear ();
+	preview_path.clear ();
+	process_format     = RGBA8888;
+	etc1_quality       = rg_etc1::cMediumQuality;
+	etc1_fast          = false;
+	etc1_error_target  = 0;
+	etc1_cache_path.clear ();
+	etc1_cache_size    = 64;
+	input_cache_path.clear ();
+	compression_format = COMPRESSION_AUTO;
+	filter_type        = Magick::UndefinedFilter;
+	process_mode       = PROCESS_NORMAL;
+	trim               = false;
+	tile_mode          = TILE_NONE;
+	tiles.clear ();
+	tile_cols = tile_rows = 0;
+	subimage_data.clear ();
+	image_data.clear ();
+	output_raw       = false;
+	max_image_height = max_image_width = 1024;
+	border = edge = 0;
+	stats::enabled = false;
+	stats::reset ();
+}
+
+/** @brief Get the directory part of a path
+ *  @param[in] path Path
+ *  @returns directory
+ */
+std::string dir_name (const std::string &path)
+{
+	std::vector<char> buffer (path.begin (), path.end ());
+	buffer.emplace_back (0);
+	return ::dirname (buffer.data ());
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/** @brief Canonicalize path; the file itself need not exist
+ *  @param[in] path Path
+ *  @returns canonical path
+ */
+std::string canonical_path (const std::string &path)
+{
+	char *dir = ::realpath (dir_name (path).c_str (), nullptr);
+	if (!dir)
+		return path;
+
+	std::string result = dir;
+	std::free (dir);
+
+	const size_t slash = path.find_last_of ('/');
+	return result + '/' + (slash == std::string::npos ? path : path.substr (slash + 1));
+}
+#endif
+
+/** @brief Read watch manifest
+ *  @param[in] path Manifest path
+ *  @returns conversions
+ */
+std::vector<Conversion> read_manifest (const std::string &path)
+{
+	const std::string text = readText (path);
+
+	std::vector<Conversion> conversions;
+	size_t pos = 0;
+	while (pos < text.size ())
+	{
+		size_t end = text.find ('\n', pos);
+		if (end == std::string::npos)
+			end = text.size ();
+
+		const std::string line = text.substr (pos, end - pos);
+		pos                    = end + 1;
+
+		// skip comments
+		const size_t first = line.find_first_not_of (" \t\r");
+		if (first == std::string::npos || line[first] == '#')
+			continue;
+
+		conversions.emplace_back (Conversion{splitOptions (line), {}});
+	}
+
+	return conversions;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/** @brief Run conversion from a watch manifest
+ *  @param[in] conversion Conversion to run; its watched files are updated
+ *  @param[in] base       Manifest directory
+ */
+void run_conversion (Conversion &conversion, const std::string &base)
+{
+	const auto start = stats::Clock::now ();
+
+	reset_options ();
+	include_stack.assign (1, base);
+
+	std::vector<char *> args;
+	for (const auto &arg : conversion.args)
+	{
+		// getopt only take non-const :(
+		args.emplace_back (const_cast<char *> (arg.c_str ()));
+	}
+
+	// reinitialize getopt
+	optind = 0;
+
+	const ParseStatus status = parseOptions (args);
+
+	// watch options files too, even if they failed to parse
+	conversion.watched.clear ();
+	for (const auto &path : input_files)
+		conversion.watched.emplace (canonical_path (path));
+	for (const auto &path : include_files)
+		conversion.watched.emplace (canonical_path (path));
+
+	if (status != PARSE_SUCCESS)
+		return;
+
+	std::string name = output_path;
+	if (name.empty ())
+		name = input_files.empty () ? "(no input)" : input_files.front ();
+
+	if (convert () != EXIT_SUCCESS)
+	{
+		// drop anything the failed conversion left in flight
+		stop_workers ();
+		result_queue.clear ();
+
+		std::fprintf (stderr, "Failed to convert %s\n", name.c_str ());
+		return;
+	}
+
+	const double ms =
+	    std::chrono::duration_cast<std::chrono::duration<double, std::milli>> (
+	        stats::Clock::now () - start)
+	        .count ();
+	std::printf ("Converted %s (%.0f ms)\n", name.c_str (), ms);
+}
+
+/** @brief Wait for files to change
+ *  @param[in]  fd      inotify descriptor
+ *  @param[in]  dirs    Watched directories, by watch descriptor
+ *  @param[out] changed Canonical paths of changed files
+ *  @returns whether successful
+ */
+bool wait_for_changes (int fd,
+    const std::map<int, std::string> &dirs,
+    std::set<std::string> &changed)
+{
+	alignas (struct inotify_event) char buffer[4096];
+
+	// block for the first change, then collect until the burst settles
+	int timeout = -1;
+	while (true)
+	{
+		struct pollfd pfd = {fd, POLLIN, 0};
+		const int rc      = ::poll (&pfd, 1, timeout);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0)
+		{
+			std::fprintf (stderr, "poll: %s\n", std::strerror (errno));
+			return false;
+		}
+
+		if (rc == 0)
+			return true;
+
+		const ssize_t len = ::read (fd, buffer, sizeof (buffer));
+		if (len < 0 && errno != EINTR && errno != EAGAIN)
+		{
+			std::fprintf (stderr, "inotify: %s\n", std::strerror (errno));
+			return false;
+		}
+
+		for (ssize_t pos = 0; pos < len;)
+		{
+			const struct inotify_event *event =
+			    reinterpret_cast<const struct inotify_event *> (&buffer[pos]);
+			pos += sizeof (struct inotify_event) + event->len;
+
+			auto dir = dirs.find (event->wd);
+			if (dir != std::end (dirs) && event->len > 0)
+				changed.emplace (dir->second + '/' + event->name);
+		}
+
+		timeout = WATCH_SETTLE_MS;
+	}
+}
+
+/** @brief Convert a manifest, then reconvert whenever its inputs change
+ *  @param[in] manifest Manifest path
+ *  @retval EXIT_FAILURE
+ */
+int watch (const std::string &manifest)
+{
+	const int fd = ::inotify_init1 (IN_CLOEXEC);
+	if (fd < 0)
+	{
+		std::fprintf (stderr, "inotify_init1: %s\n", std::strerror (errno));
+		return EXIT_FAILURE;
+	}
+
+	// keep decoded inputs for conversions that share or did not change them
+	input_cache::setRetain (true);
+
+	const std::string base         = dir_name (manifest);
+	const std::string manifest_key = canonical_path (manifest);
+
+	std::vector<Conversion> conversions;
+	std::set<size_t> pending;
+	std::map<std::string, int> watches;
+	std::map<int, std::string> dirs;
+	bool reload = true;
+
+	while (true)
+	{
+		if (reload)
+		{
+			reload = false;
+			try
+			{
+				conversions = read_manifest (manifest);
+			}
+			catch (const std::exception &e)
+			{
+				std::fprintf (stderr, "%s: %s\n", manifest.c_str (), e.what ());
+				conversions.clear ();
+			}
+
+			pending.clear ();
+			for (size_t i = 0; i < conversions.size (); ++i)
+				pending.emplace (i);
+		}
+
+		for (const auto &index : pending)
+			run_conversion (conversions[index], base);
+		pending.clear ();
+
+		// watch directories rather than files; editors often replace files on save
+		std::set<std::string> wanted{dir_name (manifest_key)};
+		for (const auto &conversion : conversions)
+		{
+			for (const auto &path : conversion.watched)
+				wanted.emplace (dir_name (path));
+		}
+
+		for (const auto &dir : wanted)
+		{
+			if (watches.count (dir))
+				continue;
+
+			const int wd = ::inotify_add_watch (fd, dir.c_str (), IN_CLOSE_WRITE | IN_MOVED_TO);
+			if (wd < 0)
+			{
+				std::fprintf (
+				    stderr, "inotify_add_watch '%s': %s\n", dir.c_str (), std::strerror (errno));
+				continue;
+			}
+
+			watches[dir] = wd;
+			dirs[wd]     = dir;
+		}
+
+		std::set<std::string> changed;
+		if (!wait_for_changes (fd, dirs, changed))
+			break;
+
+		for (const auto &path : changed)
+		{
+			if (path == manifest_key)
+				reload = true;
+
+			for (size_t i = 0; i < conversions.size (); ++i)
+			{
+				if (conversions[i].watched.count (path))
+					pending.emplace (i);
+			}
+		}
+	}
+
+	stop_workers ();
+	::close (fd);
+	return EXIT_FAILURE;
+}
+#else
+/** @brief Convert a manifest, then reconvert whenever its inputs change
+ *  @param[in] manifest Manifest path
+ *  @retval EXIT_FAILURE
+ */
+int watch (const std::string &manifest)
+{
+	std::fprintf (stderr, "--watch is not supported on this platform\n");
+	return EXIT_FAILURE;
+}
+#endif
+
+/** @brief Estimate the peak memory of a conversion with the current options
+ *  @returns estimated peak memory (bytes)
+ */
+size_t estimate_memory ()
+{
+	// process overhead, including ImageMagick and the encoder tables
+	size_t memory = 32 << 20;
+
+	size_t pixels = 0;
+	for (const auto &path : input_files)
+	{
+		try
+		{
+			// only read the header
+			Magick::Image img;
+			img.ping (path);
+			pixels += img.columns () * img.rows ();
+		}
+		catch (...)
+		{
+			// the conversion itself will report it
+		}
+	}
+
+	// full-size copies held at once: the source, img_tmp and the preview canvas
+	size_t copies = 3;
+	if (process_mode == PROCESS_CUBEMAP || process_mode == PROCESS_SKYBOX)
+		copies += 1; // faces
+	else if (process_mode == PROCESS_ATLAS)
+		copies += 1; // atlas canvas
+
+	// mipmap queue and wider preview
+	if (filter_type != Magick::UndefinedFilter)
+		copies += 1;
+
+	memory += pixels * copies * 4 * sizeof (Magick::Quantum);
+
+	size_t bits;
+	switch (process_format)
+	{
+	case RGBA8888:
+		bits = 32;
+		break;
+
+	case RGB888:
+		bits = 24;
+		break;
+
+	case RGBA5551:
+	case RGB565:
+	case RGBA4444:
+	case LA88:
+	case HILO88:
+	case AUTO_L8:
+		bits = 16;
+		break;
+
+	case L8:
+	case A8:
+	case LA44:
+	case ETC1A4:
+	case AUTO_L4:
+	case AUTO_ETC1:
+		bits = 8;
+		break;
+
+	case L4:
+	case A4:
+	case ETC1:
+	default:
+		bits = 4;
+		break;
+	}
+
+	// encoded output, with mipmaps, before and after compression
+	memory += pixels * bits / 8 * 4 / 3 * 2;
+
+	return memory;
+}
+
+/** @brief Run each line of a manifest as a conversion in its own process
+ *  @param[in] manifest Manifest path
+ *  @retval EXIT_SUCCESS
+ *  @retval EXIT_FAILURE
+ */
+int batch_convert (const std::string &manifest)
+{
+	std::vector<Conversion> conversions;
+	try
+	{
+		conversions = read_manifest (manifest);
+	}
+	catch (const std::exception &e)
+	{
+		std::fprintf (stderr, "%s: %s\n", manifest.c_str (), e.what ());
+		return EXIT_FAILURE;
+	}
+
+	// children resolve paths from the manifest directory, as --watch does
+	const std::string base = dir_name (manifest);
+
+	bool ok = true;
+	std::vector<batch::Job> queue;
+	for (auto &conversion : conversions)
+	{
+		reset_options ();
+		include_stack.assign (1, base);
+
+		std::vector<char *> args;
+		for (const auto &arg : conversion.args)
+		{
+			// getopt only take non-const :(
+			args.emplace_back (const_cast<char *> (arg.c_str ()));
+		}
+
+		// reinitialize getopt
+		optind = 0;
+
+		if (parseOptions (args) != PARSE_SUCCESS || input_files.empty ())
+		{
+			std::fprintf (stderr, "%s: Invalid conversion\n", manifest.c_str ());
+			ok = false;
+			continue;
+		}
+
+		conversion.args.front () = prog;
+
+		const std::string name = output_path.empty () ? input_files.front () : output_path;
+		queue.emplace_back (batch::Job{conversion.args, base, name, estimate_memory ()});
+	}
+
+	// each process takes job tokens for its extra threads
+	jobs::serveTokens ();
+
+	if (!batch::run (std::move (queue), memory_budget << 20))
+		ok = false;
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+}
+
+/** @brief Program entry point
+ *  @param[in] argc Number of command-line arguments
+ *  @param[in] argv Command-line arguments
+ *  @retval EXIT_SUCCESS
+ *  @retval EXIT_FAILURE
+ */
+int main (int argc, char *argv[])
+{
+	prog = argv[0];
+
+	std::setvbuf (stdout, nullptr, _IOLBF, 0);
+	std::setvbuf (stderr, nullptr, _IOLBF, 0);
+
+	std::vector<char *> args (argv, argv + argc);
+
+	// parse options
+	switch (parseOptions (args))
+	{
+	case PARSE_SUCCESS:
+		break;
+	case PARSE_FAILURE:
+		return EXIT_FAILURE;
+	case PARSE_EXIT:
+		return EXIT_SUCCESS;
+	}
+
+	// share the thread budget with ImageMagick
+	jobs::setCount (jobs_count);
+	if (memory_limit)
+		jobs::setMemoryLimit (memory_limit);
+
+	// convert on every change to the manifest's inputs
+	if (!watch_path.empty ())
+		return watch (watch_path);
+
+	// run conversions in child processes within the memory budget
+	if (!batch_path.empty ())
+		return batch_convert (batch_path);
+
+	const int rc = convert ();
+	stop_workers ();
+
+	return rc;
+}
@@ -22,7 +22,10 @@
  */
 
 #include "threadPool.h"
+#include "jobs.h"
 
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
@@ -30,14 +33,23 @@
 
 namespace
 {
+/** @brief Time an extra worker waits for a job before giving back its job token */
+const std::chrono::milliseconds IDLE_TIMEOUT (100);
+
 std::vector<std::thread> threads;
-std::queue<std::function<void (void)>> jobs;
+std::vector<std::thread::id> exited;
+std::queue<std::function<void (void)>> jobQueue;
 std::mutex mutex;
 std::condition_variable newJob;
 std::condition_variable jobTaken;
-bool quit = false;
+unsigned live = 0;
+unsigned idle = 0;
+bool quit     = false;
 
-void worker ()
+/** @brief Worker thread
+ *  @param[in] token Job token; the first worker runs on the process's own token
+ */
+void worker (jobs::Token token)
 {
 	while (true)
 	{
@@ -45,14 +57,29 @@ void worker ()
 
 		{
 			std::unique_lock<std::mutex> lock (mutex);
-			while (!quit && jobs.empty ())
-				newJob.wait (lock);
+			++idle;
+			while (!quit && jobQueue.empty ())
+			{
+				if (!token.held ())
+					newJob.wait (lock);
+				else if (newJob.wait_for (lock, IDLE_TIMEOUT) == std::cv_status::timeout &&
+				         jobQueue.empty ())
+				{
+					// nothing to do; let another process use the token
+					--idle;
+					--live;
+					exited.emplace_back (std::this_thread::get_id ());
+					token.release ();
+					return;
+				}
+			}
+			--idle;
 
 			if (quit)
 				return;
 
-			job = std::move (jobs.front ());
-			jobs.pop ();
+			job = std::move (jobQueue.front ());
+			jobQueue.pop ();
 		}
 
 		jobTaken.notify_one ();
@@ -60,14 +87,6 @@ void worker ()
 		job ();
 	}
 };
-
-std::once_flag initOnce;
-void init ()
-{
-	const auto numThreads = std::max (1u, std::thread::hardware_concurrency ());
-	for (unsigned i = 0; i < numThreads; ++i)
-		threads.emplace_back (worker);
-}
 }
 
 ThreadPool ThreadPool::pool;
@@ -91,16 +110,36 @@ ThreadPool::ThreadPool ()
 
 void ThreadPool::pushJob (std::function<void (void)> &&job)
 {
-	std::call_once (initOnce, init);
-
 	{
 		std::unique_lock<std::mutex> lock (mutex);
 
+		// reap workers that went idle
+		for (const auto &id : exited)
+		{
+			auto it = std::find_if (std::begin (threads),
+			    std::end (threads),
+			    [&id](const std::thread &thread) { return thread.get_id () == id; });
+			it->join ();
+			threads.erase (it);
+		}
+		exited.clear ();
+
+		// add a worker if nobody is free to take this job and another token is available
+		if (jobQueue.size () >= idle && live < jobs::count ())
+		{
+			jobs::Token token;
+			if (live == 0 || token.acquire ())
+			{
+				threads.emplace_back (worker, std::move (token));
+				++live;
+			}
+		}
+
 		// block while there's many outstanding jobs
-		while (jobs.size () > threads.size () * 2)
+		while (jobQueue.size () > live * 2)
 			jobTaken.wait (lock);
 
-		jobs.emplace (std::move (job));
+		jobQueue.emplace (std::move (job));
 	}
 
 	newJob.notify_one ();
@@ -23,47 +23,164 @@
 
 #include "utility.h"
 
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+/** @brief Check whether a run of alpha values is all transparent
+ *  @param[in] alpha Alpha values
+ *  @param[in] count Number of values
+ *  @returns whether all values are zero
+ */
+inline bool transparentRun (const uint16_t *alpha, size_t count)
+{
+	// four pixels per word; the OR reduction vectorizes
+	uint64_t acc = 0;
+	size_t i     = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		uint64_t word;
+		std::memcpy (&word, alpha + i, sizeof (word));
+		acc |= word;
+	}
+
+	for (; i < count; ++i)
+		acc |= alpha[i];
+
+	return acc == 0;
+}
+
+/** @brief Find the bounding box of non-transparent pixels
+ *  @param[in]  alpha  Alpha values, row-major
+ *  @param[in]  width  Image width
+ *  @param[in]  height Image height
+ *  @param[out] left   First column
+ *  @param[out] top    First row
+ *  @param[out] right  One past last column
+ *  @param[out] bottom One past last row
+ *  @returns whether any pixel is non-transparent
+ */
+bool alphaBounds (const uint16_t *alpha,
+    size_t width,
+    size_t height,
+    size_t &left,
+    size_t &top,
+    size_t &right,
+    size_t &bottom)
+{
+	top = 0;
+	while (top < height && transparentRun (&alpha[top * width], width))
+		++top;
+
+	if (top == height)
+		return false;
+
+	bottom = height;
+	while (transparentRun (&alpha[(bottom - 1) * width], width))
+		--bottom;
+
+	// each row only needs scanning outside of the columns found so far
+	left  = width;
+	right = 0;
+	for (size_t y = top; y < bottom; ++y)
+	{
+		const uint16_t *row = &alpha[y * width];
+
+		size_t x = 0;
+		while (x < left && row[x] == 0)
+			++x;
+		left = x < left ? x : left;
+
+		x = width;
+		while (x > right && row[x - 1] == 0)
+			--x;
+		right = x > right ? x : right;
+	}
+
+	return true;
+}
+}
+
 Magick::Image applyTrim (Magick::Image &img)
 {
-	Magick::Image copy = img;
+	const size_t width  = img.columns ();
+	const size_t height = img.rows ();
 
-	try
+	// 16 bits per value so that faint alpha does not round to transparent
+	std::vector<uint16_t> alpha (width * height);
+	if (!alpha.empty ())
+		img.write (0, 0, width, height, "A", Magick::ShortPixel, alpha.data ());
+
+	// ImageMagick trims the top and left edges by the top-left color, the right edge by the
+	// top-right color and the bottom edge by the bottom-left color; when all of those are
+	// transparent, the trim is just the alpha bounding box
+	if (alpha.empty () || alpha[0] != 0 || alpha[width - 1] != 0 ||
+	    alpha[(height - 1) * width] != 0)
 	{
-		img.trim ();
-		img.page (Magick::Geometry (img.columns (), img.rows ()));
-		return img;
+		Magick::Image copy = img;
+
+		try
+		{
+			img.trim ();
+			img.page (Magick::Geometry (img.columns (), img.rows ()));
+			return img;
+		}
+		catch (...)
+		{
+			// image was solid
+			return copy;
+		}
 	}
-	catch (...)
+
+	size_t left, top, right, bottom;
+	if (!alphaBounds (alpha.data (), width, height, left, top, right, bottom))
 	{
 		// image was solid
-		return copy;
+		return img;
+	}
+
+	// crop relative to the image rather than its page
+	img.page (Magick::Geometry (width, height));
+	if (left != 0 || top != 0 || right != width || bottom != height)
+	{
+		img.crop (Magick::Geometry (right - left, bottom - top, left, top));
+		img.page (Magick::Geometry (img.columns (), img.rows ()));
 	}
+
+	return img;
 }
 
 void applyEdge (Magick::Image &img)
 {
-	Magick::Image edged (Magick::Geometry (img.columns () + 2, img.rows () + 2), transparent ());
-	edged.fileName (img.fileName ());
+	const size_t w      = img.columns ();
+	const size_t h      = img.rows ();
+	const size_t stride = (w + 2) * 4;
 
-	edged.composite (img, Magick::Geometry (0, 0, 1, 1), Magick::OverCompositeOp);
+	// 16 bits per component so that atlas inputs keep their depth
+	std::vector<uint16_t> src (w * h * 4);
+	if (!src.empty ())
+		img.write (0, 0, w, h, "RGBA", Magick::ShortPixel, src.data ());
 
-	Pixels cache (edged);
-	PixelPacket p = cache.get (0, 0, edged.columns (), edged.rows ());
-
-	for (unsigned x = 1; x < edged.columns () - 1; ++x)
+	std::vector<uint16_t> dst (stride * (h + 2));
+	for (size_t y = 0; y < h; ++y)
 	{
-		p[x] = p[edged.columns () + x];
-		p[(edged.rows () - 1) * edged.columns () + x] =
-		    p[(edged.rows () - 2) * edged.columns () + x];
-	}
+		const uint16_t *in = &src[y * w * 4];
+		uint16_t *out      = &dst[(y + 1) * stride];
 
-	for (unsigned y = 0; y < edged.rows (); ++y)
-	{
-		p[y * edged.columns ()]           = p[y * edged.columns () + 1];
-		p[(y + 1) * edged.columns () - 1] = p[(y + 1) * edged.columns () - 2];
+		// repeat the first and last pixels outward
+		std::memcpy (&out[0], in, 4 * sizeof (uint16_t));
+		std::memcpy (&out[(w + 1) * 4], &in[(w - 1) * 4], 4 * sizeof (uint16_t));
+		std::memcpy (&out[4], in, w * 4 * sizeof (uint16_t));
 	}
 
-	cache.sync ();
+	// repeat the first and last rows outward
+	std::memcpy (&dst[0], &dst[stride], stride * sizeof (uint16_t));
+	std::memcpy (&dst[(h + 1) * stride], &dst[h * stride], stride * sizeof (uint16_t));
+
+	Magick::Image edged (w + 2, h + 2, "RGBA", Magick::ShortPixel, dst.data ());
+	edged.fileName (img.fileName ());
 
 	img = edged;
 }
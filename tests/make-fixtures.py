@@ -0,0 +1,341 @@
+#!/usr/bin/env python3
+# make-fixtures.py -- regenerate the check suite fixtures
+#
+# The fixtures are checked in; this script only documents how they were made.
+# Every image and the font are generated from fixed seeds, so rerunning it
+# reproduces the same files.
+
+import os
+import struct
+import zlib
+
+HERE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "fixtures")
+
+
+class Lcg:
+    """Small deterministic noise source"""
+
+    def __init__(self, seed):
+        self.state = seed
+
+    def next(self, n):
+        self.state = (self.state * 1103515245 + 12345) & 0x7FFFFFFF
+        return (self.state >> 16) % n
+
+
+def write_png(name, width, height, pixels, alpha=True):
+    """Write an 8-bit RGB or RGBA PNG; pixels is a list of (r, g, b, a) rows"""
+    raw = bytearray()
+    for row in pixels:
+        raw.append(0)
+        for r, g, b, a in row:
+            raw += bytes((r, g, b, a) if alpha else (r, g, b))
+
+    def chunk(tag, data):
+        body = tag + data
+        return struct.pack(">I", len(data)) + body + struct.pack(">I", zlib.crc32(body))
+
+    ihdr = struct.pack(">IIBBBBB", width, height, 8, 6 if alpha else 2, 0, 0, 0)
+    with open(os.path.join(HERE, name), "wb") as fp:
+        fp.write(b"\x89PNG\r\n\x1a\n")
+        fp.write(chunk(b"IHDR", ihdr))
+        fp.write(chunk(b"IDAT", zlib.compress(bytes(raw), 9)))
+        fp.write(chunk(b"IEND", b""))
+
+
+def gradient(width, height, seed, alpha=True):
+    """Color gradient with noise and, optionally, an alpha ramp"""
+    noise = Lcg(seed)
+    rows = []
+    for y in range(height):
+        row = []
+        for x in range(width):
+            r = (x * 255 // max(width - 1, 1) + noise.next(16)) & 0xFF
+            g = (y * 255 // max(height - 1, 1) + noise.next(16)) & 0xFF
+            b = ((x ^ y) * 4) & 0xFF
+            a = (x + y) * 255 // max(width + height - 2, 1) if alpha else 255
+            row.append((r, g, b, a))
+        rows.append(row)
+    return rows
+
+
+def sprite(width, height, margin, color):
+    """Solid shape with a diagonal cut, surrounded by a transparent margin"""
+    rows = []
+    for y in range(height):
+        row = []
+        for x in range(width):
+            inside = margin <= x < width - margin and margin <= y < height - margin
+            if inside and x - margin >= (y - margin) // 2:
+                row.append(color + (255,))
+            else:
+                row.append((0, 0, 0, 0))
+        rows.append(row)
+    return rows
+
+
+FACE_COLORS = [
+    (255, 64, 64),
+    (64, 255, 64),
+    (64, 64, 255),
+    (255, 255, 64),
+    (255, 64, 255),
+    (64, 255, 255),
+]
+
+
+def face(size, index):
+    """Cube face with a distinct color and an orientation marker"""
+    color = FACE_COLORS[index]
+    rows = []
+    for y in range(size):
+        row = []
+        for x in range(size):
+            if x < size // 4 and y < size // 4:
+                row.append((255, 255, 255, 255))
+            else:
+                shade = (x + y) * 2
+                row.append(tuple(max(c - shade, 0) for c in color) + (255,))
+        rows.append(row)
+    return rows
+
+
+def cross(size, order):
+    """Cubemap/skybox cross; order gives the face index of each cell"""
+    rows = [[(0, 0, 0, 0)] * (4 * size) for _ in range(3 * size)]
+    for (col, row), index in order.items():
+        tile = face(size, index)
+        for y in range(size):
+            rows[row * size + y][col * size : (col + 1) * size] = tile[y]
+    return rows
+
+
+# TrueType font: each glyph is a 5x7 grid of square cells chosen from the
+# codepoint, so glyphs are distinct apart from a deliberate duplicate pair.
+
+UNITS_PER_EM = 1024
+CELL = 128
+COLS, ROWS = 5, 7
+ASCENT = 960
+DESCENT = -192
+ADVANCE = (COLS + 1) * CELL
+
+
+def glyph_cells(code):
+    if code == ord("0"):
+        code = ord("O")  # identical outlines under different glyph indices
+
+    noise = Lcg(code * 2654435761 & 0x7FFFFFFF)
+    cells = [(x, y) for y in range(ROWS) for x in range(COLS) if noise.next(100) < 45]
+    return cells or [(2, 3)]
+
+
+def glyph_data(cells):
+    """Simple glyph with one square contour per cell"""
+    xs = [x * CELL for x, _ in cells] + [(x + 1) * CELL for x, _ in cells]
+    ys = [y * CELL for _, y in cells] + [(y + 1) * CELL for _, y in cells]
+    data = struct.pack(">hhhhh", len(cells), min(xs), min(ys), max(xs), max(ys))
+
+    points = []
+    for x, y in cells:
+        x0, y0, x1, y1 = x * CELL, y * CELL, (x + 1) * CELL, (y + 1) * CELL
+        points += [(x0, y0), (x0, y1), (x1, y1), (x1, y0)]  # clockwise
+
+    data += b"".join(struct.pack(">H", 4 * i + 3) for i in range(len(cells)))
+    data += struct.pack(">H", 0)  # instructions
+    # on-curve points with one-byte deltas where they fit
+    flags, xs, ys = b"", b"", b""
+    last_x = last_y = 0
+    for x, y in points:
+        flag = 0x01
+        deltas = ((x - last_x, 0x02, 0x10, "x"), (y - last_y, 0x04, 0x20, "y"))
+        for delta, short, same, out in deltas:
+            if delta == 0:
+                flag |= same
+                continue
+            if abs(delta) <= 255:
+                flag |= short | (same if delta > 0 else 0)
+                packed = struct.pack(">B", abs(delta))
+            else:
+                packed = struct.pack(">h", delta)
+            if out == "x":
+                xs += packed
+            else:
+                ys += packed
+        flags += bytes([flag])
+        last_x, last_y = x, y
+
+    data += flags + xs + ys
+    return data + b"\0" * (-len(data) % 4), len(points), len(cells)
+
+
+def checksum(data):
+    data += b"\0" * (-len(data) % 4)
+    return sum(struct.unpack(">%dI" % (len(data) // 4), data)) & 0xFFFFFFFF
+
+
+def write_font(name):
+    first, last = 0x20, 0x7E
+    glyphs = [(b"", 0, 0), (b"", 0, 0)]  # .notdef, space
+    for code in range(first + 1, last + 1):
+        glyphs.append(glyph_data(glyph_cells(code)))
+
+    glyf = b"".join(g[0] for g in glyphs)
+    offsets = [0]
+    for g in glyphs:
+        offsets.append(offsets[-1] + len(g[0]))
+    loca = b"".join(struct.pack(">I", o) for o in offsets)
+
+    num_glyphs = len(glyphs)
+    max_points = max(g[1] for g in glyphs)
+    max_contours = max(g[2] for g in glyphs)
+
+    head = struct.pack(
+        ">IIIIHHqqhhhhHHhhh",
+        0x00010000,
+        0x00010000,
+        0,  # checkSumAdjustment, patched below
+        0x5F0F3CF5,
+        0x000B,
+        UNITS_PER_EM,
+        0,
+        0,
+        0,
+        0,
+        COLS * CELL,
+        ROWS * CELL,
+        0,
+        8,
+        2,
+        1,  # long loca offsets
+        0,
+    )
+
+    hhea = struct.pack(
+        ">IhhhHhhhhhhhhhhhH",
+        0x00010000,
+        ASCENT,
+        DESCENT,
+        0,
+        ADVANCE,
+        0,
+        CELL,
+        COLS * CELL,
+        1,
+        0,
+        0,
+        0,
+        0,
+        0,
+        0,
+        0,
+        num_glyphs,
+    )
+
+    maxp = struct.pack(
+        ">IHHHHHHHHHHHHHH",
+        0x00010000,
+        num_glyphs,
+        max_points,
+        max_contours,
+        0,
+        0,
+        2,
+        0,
+        0,
+        0,
+        0,
+        0,
+        0,
+        0,
+        0,
+    )
+
+    hmtx = struct.pack(">Hh", ADVANCE, 0) * num_glyphs
+
+    # format 4: one segment for the printable ASCII range, then the terminator
+    seg_count = 2
+    subtable = struct.pack(
+        ">HHHHHHH", 4, 16 + 8 * seg_count, 0, 2 * seg_count, 4, 1, 0
+    )
+    subtable += struct.pack(">HH", last, 0xFFFF)
+    subtable += struct.pack(">H", 0)
+    subtable += struct.pack(">HH", first, 0xFFFF)
+    subtable += struct.pack(">HH", (1 - first) & 0xFFFF, 1)
+    subtable += struct.pack(">HH", 0, 0)
+    cmap = struct.pack(">HHHHI", 0, 1, 3, 1, 12) + subtable
+
+    names = {1: "Tex3ds Check", 2: "Regular", 4: "Tex3ds Check Regular", 6: "Tex3dsCheck-Regular"}
+    strings = b""
+    records = b""
+    for name_id, text in sorted(names.items()):
+        encoded = text.encode("utf-16-be")
+        records += struct.pack(">HHHHHH", 3, 1, 0x409, name_id, len(encoded), len(strings))
+        strings += encoded
+    name_table = struct.pack(">HHH", 0, len(names), 6 + len(records)) + records + strings
+
+    post = struct.pack(">IIhhIIIII", 0x00030000, 0, -100, 50, 1, 0, 0, 0, 0)
+
+    tables = {
+        b"cmap": cmap,
+        b"glyf": glyf,
+        b"head": head,
+        b"hhea": hhea,
+        b"hmtx": hmtx,
+        b"loca": loca,
+        b"maxp": maxp,
+        b"name": name_table,
+        b"post": post,
+    }
+
+    count = len(tables)
+    power = 1 << (count.bit_length() - 1)
+    directory = struct.pack(">IHHHH", 0x00010000, count, power * 16, power.bit_length() - 1,
+                            count * 16 - power * 16)
+
+    offset = 12 + 16 * count
+    body = b""
+    for tag in sorted(tables):
+        data = tables[tag]
+        directory += struct.pack(">4sIII", tag, checksum(data), offset + len(body), len(data))
+        body += data + b"\0" * (-len(data) % 4)
+
+    font = bytearray(directory + body)
+    head_offset = 12 + 16 * count + body.index(head)
+    adjustment = (0xB1B0AFBA - checksum(bytes(font))) & 0xFFFFFFFF
+    font[head_offset + 8 : head_offset + 12] = struct.pack(">I", adjustment)
+
+    with open(os.path.join(HERE, name), "wb") as fp:
+        fp.write(font)
+
+
+def main():
+    os.makedirs(HERE, exist_ok=True)
+
+    write_png("rgba.png", 64, 64, gradient(64, 64, 1))
+    write_png("opaque.png", 64, 32, gradient(64, 32, 2, alpha=False), alpha=False)
+
+    write_png("sprite-a.png", 24, 14, sprite(24, 14, 2, (200, 40, 40)))
+    write_png("sprite-b.png", 10, 30, sprite(10, 30, 1, (40, 200, 40)))
+    write_png("sprite-c.png", 16, 16, sprite(16, 16, 3, (40, 40, 200)))
+    write_png("sprite-d.png", 16, 16, sprite(16, 16, 3, (40, 40, 200)))
+    write_png("sprite-e.png", 33, 7, sprite(33, 7, 0, (220, 180, 20)))
+
+    # cells of the cross layout, indexed by face: px, nx, py, ny, pz, nz
+    write_png("cubemap.png", 128, 96,
+              cross(32, {(2, 1): 0, (0, 1): 1, (1, 0): 2, (1, 2): 3, (1, 1): 4, (3, 1): 5}))
+    write_png("skybox.png", 128, 96,
+              cross(32, {(2, 1): 0, (0, 1): 1, (1, 0): 2, (1, 2): 3, (3, 1): 4, (1, 1): 5}))
+    for index, suffix in enumerate(["px", "nx", "py", "ny", "pz", "nz"]):
+        write_png("face-%s.png" % suffix, 32, 32, face(32, index))
+
+    write_font("blocks.ttf")
+
+    with open(os.path.join(HERE, "whitelist.txt"), "w") as fp:
+        fp.write(" ".join("0x%02X" % c for c in b"0123456789ABCDEFOabcdef") + "\n")
+    with open(os.path.join(HERE, "blacklist.txt"), "w") as fp:
+        fp.write(" ".join("0x%02X" % c for c in b"abcdefghijklmnopqrstuvwxyz") + "\n")
+
+
+if __name__ == "__main__":
+    main()
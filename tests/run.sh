@@ -0,0 +1,150 @@
+#!/bin/sh
+# run.sh -- golden-output and timing checks for tex3ds and mkbcfnt
+#
+# Usage: run.sh check|update <tests dir> <output dir>
+#
+#   check   Run every case in <tests dir>/cases, compare each output file
+#           against golden.sha256 and each run time against timing.baseline
+#   update  Run every case and rewrite golden.sha256 and timing.baseline
+#
+# Environment:
+#   TEX3DS, MKBCFNT  Programs under test (default: ./tex3ds, ./mkbcfnt)
+#   CHECK_SLOWDOWN   Fail when a case takes longer than this factor times its
+#                    baseline (default: 2)
+#   CHECK_SLACK_MS   Extra time allowed on top of that, to absorb noise on
+#                    short cases (default: 100)
+#   CHECK_TIMING     Set to "no" to skip the timing comparison
+
+mode=$1
+tests=$2
+output=$3
+
+if [ "$mode" != check ] && [ "$mode" != update ] || [ -z "$tests" ] || [ -z "$output" ]; then
+	echo "Usage: $0 check|update <tests dir> <output dir>" >&2
+	exit 2
+fi
+
+TEX3DS=${TEX3DS:-./tex3ds}
+MKBCFNT=${MKBCFNT:-./mkbcfnt}
+CHECK_SLOWDOWN=${CHECK_SLOWDOWN:-2}
+CHECK_SLACK_MS=${CHECK_SLACK_MS:-100}
+CHECK_TIMING=${CHECK_TIMING:-yes}
+
+fixtures=$(cd "$tests/fixtures" && pwd)
+golden=$tests/golden.sha256
+baseline=$tests/timing.baseline
+
+if command -v sha256sum >/dev/null 2>&1; then
+	sha256() { sha256sum | cut -d' ' -f1; }
+else
+	sha256() { shasum -a 256 | cut -d' ' -f1; }
+fi
+
+# millisecond clock; timing is skipped where date has no %N
+case $(date +%N) in
+*[!0-9]* | "")
+	CHECK_TIMING=no
+	now_ms() { echo 0; }
+	;;
+*)
+	now_ms() { echo $(($(date +%s%N) / 1000000)); }
+	;;
+esac
+
+rm -rf "$output"
+mkdir -p "$output"
+hashes=$output/golden.sha256
+timings=$output/timing.baseline
+: >"$hashes"
+: >"$timings"
+
+cases=0
+failed=0
+while read -r name program args; do
+	case $name in
+	"#"* | "") continue ;;
+	esac
+
+	case $program in
+	tex3ds) program=$TEX3DS ;;
+	mkbcfnt) program=$MKBCFNT ;;
+	*)
+		echo "$name: unknown program '$program'" >&2
+		exit 2
+		;;
+	esac
+
+	cases=$((cases + 1))
+	out=$output/$name
+	mkdir -p "$out"
+	args=$(echo "$args" | sed -e "s|@SRC@|$fixtures|g" -e "s|@OUT@|$out|g")
+
+	start=$(now_ms)
+	# shellcheck disable=SC2086 # arguments are split on purpose
+	$program $args >"$output/$name.log" 2>&1
+	status=$?
+	ms=$(($(now_ms) - start))
+
+	if [ $status -ne 0 ]; then
+		echo "FAIL: $name (exit status $status, see $output/$name.log)"
+		failed=$((failed + 1))
+		continue
+	fi
+
+	for file in $(cd "$out" && ls | sort); do
+		echo "$(sha256 <"$out/$file")  $name/$file" >>"$hashes"
+	done
+	echo "$name $ms" >>"$timings"
+
+	[ "$mode" = update ] && continue
+
+	actual=$(grep "  $name/" "$hashes")
+	expected=$(grep "  $name/" "$golden")
+	if [ -z "$expected" ]; then
+		echo "FAIL: $name (no golden hashes; run make check-update)"
+		failed=$((failed + 1))
+		continue
+	fi
+
+	if [ "$actual" != "$expected" ]; then
+		echo "FAIL: $name (output differs from golden)"
+		echo "$expected" | sed 's/^/  expected /'
+		echo "$actual" | sed 's/^/  actual   /'
+		failed=$((failed + 1))
+		continue
+	fi
+
+	base=$(awk -v name="$name" '$1 == name { print $2 }' "$baseline")
+	if [ "$CHECK_TIMING" != no ] && [ -n "$base" ]; then
+		limit=$(awk -v base="$base" -v factor="$CHECK_SLOWDOWN" -v slack="$CHECK_SLACK_MS" \
+			'BEGIN { printf "%d", base * factor + slack }')
+		if [ "$ms" -gt "$limit" ]; then
+			echo "FAIL: $name (${ms} ms, baseline ${base} ms, limit ${limit} ms)"
+			failed=$((failed + 1))
+			continue
+		fi
+	fi
+
+	echo "PASS: $name (${ms} ms)"
+done <"$tests/cases"
+
+if [ "$mode" = update ]; then
+	if [ $failed -ne 0 ]; then
+		echo "$failed of $cases cases failed to run; golden files not updated"
+		exit 1
+	fi
+
+	{
+		echo "# Golden output hashes; regenerate with make check-update"
+		cat "$hashes"
+	} >"$golden"
+	{
+		echo "# Per-case run time in ms; regenerate with make check-update"
+		cat "$timings"
+	} >"$baseline"
+	echo "Updated $golden and $baseline from $cases cases"
+	exit 0
+fi
+
+echo "$((cases - failed)) of $cases cases passed"
+[ $failed -eq 0 ]